@@ -60,6 +60,8 @@ Token *ast_node_token(Node *node)
         return &((ArrayLiteral *)node)->token;
     case NODE_INDEX_EXPRESSION:
         return &((IndexExpression *)node)->token;
+    case NODE_HASH_LITERAL:
+        return &((HashLiteral *)node)->token;
     default:
         return NULL;
     }
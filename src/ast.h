@@ -3,6 +3,7 @@
 
 #include "lexer.h"
 #include "error.h"
+#include "object.h"
 
 typedef enum
 {
@@ -25,6 +26,7 @@ typedef enum
     NODE_FOR_STATEMENT,
     NODE_ARRAY_LITERAL,
     NODE_INDEX_EXPRESSION,
+    NODE_HASH_LITERAL,
 } NodeType;
 
 // The base Node interface
@@ -83,7 +85,7 @@ typedef struct StringLiteral
 {
     Expression expression;
     Token token;
-    char *value;
+    String *value; /* Shared by every evaluation of the literal */
 } StringLiteral;
 
 typedef struct NullLiteral
@@ -140,6 +142,13 @@ typedef struct FunctionLiteral
     Identifier **parameters;
     int parameter_count;
     BlockStatement *body;
+
+    // Filled in by scope analysis once the body is parsed
+    char **free_names;  // names read from enclosing scopes; captured at creation
+    int free_count;
+    char **boxed_names; // own bindings a nested closure captures and this body rebinds
+    int boxed_count;
+    int frame_size;     // parameters plus distinct local names, sizes call frames
 } FunctionLiteral;
 
 typedef struct CallExpression
@@ -192,6 +201,15 @@ typedef struct ArrayLiteral
     int element_count;
 } ArrayLiteral;
 
+typedef struct HashLiteral
+{
+    Expression expression;
+    Token token; // The '{' token
+    Expression **keys;
+    Expression **values;
+    int pair_count;
+} HashLiteral;
+
 typedef struct IndexExpression
 {
     Expression expression;
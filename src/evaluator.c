@@ -1,15 +1,31 @@
+#define _POSIX_C_SOURCE 200809L /* strdup */
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include "evaluator.h"
 #include "gc.h"
+#include "numeric.h"
 
 static Object *TRUE_OBJ;
 static Object *FALSE_OBJ;
 static Object *NULL_OBJ;
 
-static Environment *GLOBAL_ENV;
+static Environment *GLOBAL_ENV;  /* Current scope: the running call's frame, or ROOT_ENV */
+static Environment *ROOT_ENV;    /* Top-level scope; globals are always looked up late */
+static FunctionLiteral *CURRENT_FUNCTION = NULL; /* Function owning GLOBAL_ENV */
+
+/* Pending control-flow signal. A return statement sets it and hands its value
+ * back through the normal result path; every enclosing block stops on it and
+ * the function call that owns it clears it, so no wrapper object is needed. */
+typedef enum
+{
+    SIGNAL_NONE,
+    SIGNAL_RETURN,
+} EvalSignal;
+
+static EvalSignal EVAL_SIGNAL = SIGNAL_NONE;
 
 /* Evaluation context */
 static EvalContext EVAL_CONTEXT = {NULL, NULL};
@@ -106,20 +122,149 @@ static const char *type_name(ObjectType type)
         return "NULL";
     case OBJECT_ARRAY:
         return "ARRAY";
+    case OBJECT_HASH:
+        return "HASH";
     case OBJECT_FUNCTION:
         return "FUNCTION";
     case OBJECT_BUILTIN:
         return "BUILTIN";
     case OBJECT_ERROR:
         return "ERROR";
-    case OBJECT_RETURN_VALUE:
-        return "RETURN_VALUE";
+    case OBJECT_CELL:
+        return "CELL";
     default:
         return "UNKNOWN";
     }
 }
 
 /* Built-in functions */
+/* Allocate an OBJECT_STRING holding a copy of `length` bytes: inline when
+ * they fit, otherwise in a String payload */
+static Object *new_string(const char *bytes, int length)
+{
+    if (length <= OBJECT_SMALL_MAX)
+    {
+        Object *obj = gc_alloc_object();
+        obj->type = OBJECT_STRING;
+        obj->flags = OBJECT_STRING_SMALL;
+        obj->small_length = length;
+        memcpy(OBJECT_SMALL_BYTES(obj), bytes, length);
+        return obj;
+    }
+
+    String *string = gc_alloc_payload(STRING_BYTES(length));
+    string_init(string, bytes, length);
+
+    Object *obj = gc_alloc_object();
+    obj->type = OBJECT_STRING;
+    obj->value.string = string;
+    obj->flags = OBJECT_STRING_OWNED;
+    return obj;
+}
+
+/* Print an element of an array or hash, quoting strings */
+static void print_element(Object *elem)
+{
+    if (elem->type == OBJECT_INTEGER)
+    {
+        printf("%lld", elem->value.integer);
+    }
+    else if (elem->type == OBJECT_STRING)
+    {
+        printf("\"%.*s\"", string_object_length(elem), string_object_bytes(elem));
+    }
+    else if (elem->type == OBJECT_BOOLEAN)
+    {
+        printf("%s", elem->value.boolean ? "จริง" : "เท็จ");
+    }
+    else if (elem->type == OBJECT_NULL)
+    {
+        printf("ว่างเปล่า");
+    }
+    else if (elem->type == OBJECT_ARRAY)
+    {
+        printf("[nested array]");
+    }
+    else if (elem->type == OBJECT_HASH)
+    {
+        printf("{nested hash}");
+    }
+    else
+    {
+        printf("[%s]", type_name(elem->type));
+    }
+}
+
+/* A hash key, shown as print_element() shows the key's object */
+static void print_hash_key(HashEntry *entry)
+{
+    if (entry->key_type == OBJECT_STRING)
+    {
+        print_element(entry->key.string);
+    }
+    else if (entry->key_type == OBJECT_INTEGER)
+    {
+        printf("%lld", (long long)entry->key.scalar);
+    }
+    else
+    {
+        printf("%s", entry->key.scalar ? "จริง" : "เท็จ");
+    }
+}
+
+static Object *new_integer(int64_t value)
+{
+    Object *obj = gc_alloc_object();
+    obj->type = OBJECT_INTEGER;
+    obj->value.integer = value;
+    return obj;
+}
+
+/* An empty array with room for `capacity` elements, unboxed if `ints` */
+static Object *new_array(int capacity, int ints)
+{
+    if (capacity < 1)
+    {
+        capacity = 1;
+    }
+    ArrayStorage *storage = gc_alloc_payload(ints ? ARRAY_INTS_BYTES(capacity) : ARRAY_STORAGE_BYTES(capacity));
+    storage->length = 0;
+    storage->capacity = capacity;
+
+    Object *arr = gc_alloc_object();
+    arr->type = OBJECT_ARRAY;
+    arr->value.array = storage;
+    arr->flags = ints ? OBJECT_ARRAY_INTS : 0;
+    return arr;
+}
+
+/* Turn an unboxed array into a boxed one, allocating an object per element.
+ * The array holds the boxes made so far, so a collection part way through
+ * keeps them. */
+static void array_box(Object *arr)
+{
+    ArrayStorage *ints = arr->value.array;
+    ArrayStorage *storage = gc_alloc_payload(ARRAY_STORAGE_BYTES(ints->capacity));
+    storage->length = 0;
+    storage->capacity = ints->capacity;
+
+    gc_lock_object(arr);
+    arr->value.array = storage;
+    arr->flags &= ~OBJECT_ARRAY_INTS;
+    gc_unlock_object(arr);
+
+    for (int i = 0; i < ints->length; i++)
+    {
+        Object *box = new_integer(ARRAY_INTS(ints)[i]);
+        gc_lock_object(arr);
+        storage->elements[i] = box;
+        gc_write_barrier(arr, i, NULL, box);
+        storage->length++;
+        gc_unlock_object(arr);
+    }
+    gc_free_payload(ints, ARRAY_INTS_BYTES(ints->capacity));
+}
+
 static Object *builtin_print(Object **args, int arg_count)
 {
     for (int i = 0; i < arg_count; i++)
@@ -134,49 +279,54 @@ static Object *builtin_print(Object **args, int arg_count)
         }
         else if (args[i]->type == OBJECT_STRING)
         {
-            printf("%s", args[i]->value.string.data);
+            fwrite(string_object_bytes(args[i]), 1, string_object_length(args[i]), stdout);
         }
         else if (args[i]->type == OBJECT_NULL)
         {
             printf("ว่างเปล่า");
         }
+        else if (args[i]->type == OBJECT_ARRAY && (args[i]->flags & OBJECT_ARRAY_INTS))
+        {
+            printf("[");
+            for (int j = 0; j < args[i]->value.array->length; j++)
+            {
+                printf("%s%lld", j > 0 ? ", " : "", (long long)ARRAY_INTS(args[i]->value.array)[j]);
+            }
+            printf("]");
+        }
         else if (args[i]->type == OBJECT_ARRAY)
         {
             printf("[");
-            for (int j = 0; j < args[i]->value.array.length; j++)
+            for (int j = 0; j < args[i]->value.array->length; j++)
             {
-                Object *elem = args[i]->value.array.elements[j];
-                if (elem->type == OBJECT_INTEGER)
-                {
-                    printf("%lld", elem->value.integer);
-                }
-                else if (elem->type == OBJECT_STRING)
-                {
-                    printf("\"%s\"", elem->value.string.data);
-                }
-                else if (elem->type == OBJECT_BOOLEAN)
-                {
-                    printf("%s", elem->value.boolean ? "จริง" : "เท็จ");
-                }
-                else if (elem->type == OBJECT_NULL)
-                {
-                    printf("ว่างเปล่า");
-                }
-                else if (elem->type == OBJECT_ARRAY)
-                {
-                    printf("[nested array]");
-                }
-                else
-                {
-                    printf("[%s]", type_name(elem->type));
-                }
-                if (j < args[i]->value.array.length - 1)
+                print_element(args[i]->value.array->elements[j]);
+                if (j < args[i]->value.array->length - 1)
                 {
                     printf(", ");
                 }
             }
             printf("]");
         }
+        else if (args[i]->type == OBJECT_HASH)
+        {
+            /* Pairs come out in table order, not insertion order */
+            HashTable *table = args[i]->value.hash;
+            int printed = 0;
+            printf("{");
+            for (int j = 0; j < table->capacity; j++)
+            {
+                if (table->entries[j].value == NULL)
+                {
+                    continue;
+                }
+                printf("%s", printed > 0 ? ", " : "");
+                print_hash_key(&table->entries[j]);
+                printf(": ");
+                print_element(table->entries[j].value);
+                printed++;
+            }
+            printf("}");
+        }
         if (i < arg_count - 1)
         {
             printf(" ");
@@ -188,100 +338,480 @@ static Object *builtin_print(Object **args, int arg_count)
 
 static Object *builtin_len(Object **args, int arg_count)
 {
-    if (arg_count != 1)
-    {
-        return runtime_error("len() takes exactly 1 argument, got %d", arg_count);
-    }
-
+    (void)arg_count;
     Object *obj = args[0];
 
+    Object *result = gc_alloc_object();
+    result->type = OBJECT_INTEGER;
     if (obj->type == OBJECT_STRING)
     {
-        Object *result = gc_alloc_object();
-        result->type = OBJECT_INTEGER;
-        result->value.integer = (int64_t)strlen(obj->value.string.data);
-        return result;
+        result->value.integer = (int64_t)string_object_chars(obj);
     }
-    else if (obj->type == OBJECT_ARRAY)
+    else if (obj->type == OBJECT_HASH)
     {
-        Object *result = gc_alloc_object();
-        result->type = OBJECT_INTEGER;
-        result->value.integer = (int64_t)obj->value.array.length;
-        return result;
+        result->value.integer = (int64_t)obj->value.hash->count;
     }
     else
     {
-        return runtime_error("len() not supported for type %s", type_name(obj->type));
+        result->value.integer = (int64_t)obj->value.array->length;
     }
+    return result;
 }
 
 static Object *builtin_push(Object **args, int arg_count)
 {
-    if (arg_count != 2)
-    {
-        return runtime_error("push() takes exactly 2 arguments (array, value), got %d", arg_count);
-    }
-
+    (void)arg_count;
     Object *arr = args[0];
     Object *value = args[1];
 
-    if (arr->type != OBJECT_ARRAY)
+    /* The first non-integer turns an unboxed array into a boxed one */
+    if ((arr->flags & OBJECT_ARRAY_INTS) && value->type != OBJECT_INTEGER)
     {
-        return runtime_error("push() requires ARRAY as first argument, got %s", type_name(arr->type));
+        array_box(arr);
     }
+    int ints = arr->flags & OBJECT_ARRAY_INTS;
+
+    gc_lock_object(arr);
 
     /* Check if we need to resize */
-    if (arr->value.array.length >= arr->value.array.capacity)
+    ArrayStorage *storage = arr->value.array;
+    if (storage->length >= storage->capacity)
     {
-        int new_capacity = arr->value.array.capacity * 2;
+        int new_capacity = storage->capacity * 2;
         if (new_capacity < 2)
         {
             new_capacity = 2;
         }
 
-        Object **new_elements = realloc(arr->value.array.elements, sizeof(Object *) * new_capacity);
-        if (new_elements == NULL)
+        storage = gc_realloc_payload(storage, ARRAY_BYTES(arr),
+                                     ints ? ARRAY_INTS_BYTES(new_capacity) : ARRAY_STORAGE_BYTES(new_capacity));
+        storage->capacity = new_capacity;
+        arr->value.array = storage;
+    }
+
+    /* Add the new element */
+    if (ints)
+    {
+        ARRAY_INTS(storage)[storage->length] = value->value.integer;
+    }
+    else
+    {
+        storage->elements[storage->length] = value;
+        gc_write_barrier(arr, storage->length, NULL, value);
+    }
+    storage->length++;
+
+    gc_unlock_object(arr);
+    return arr;
+}
+
+static Object *builtin_pop(Object **args, int arg_count)
+{
+    (void)arg_count;
+    Object *arr = args[0];
+
+    if (arr->value.array->length == 0)
+    {
+        return runtime_error("pop() called on empty array");
+    }
+
+    /* An unboxed element needs no barrier, only a box once it is off */
+    ArrayStorage *storage = arr->value.array;
+    if (arr->flags & OBJECT_ARRAY_INTS)
+    {
+        storage->length--;
+        return new_integer(ARRAY_INTS(storage)[storage->length]);
+    }
+
+    /* Get the last element */
+    gc_lock_object(arr);
+    Object *popped = storage->elements[storage->length - 1];
+    gc_write_barrier(arr, storage->length - 1, popped, NULL);
+    storage->length--;
+    gc_unlock_object(arr);
+
+    return popped;
+}
+
+/* The `length` bytes at `offset` in `string`, holding `chars` code points.
+ * Short ones are copied inline and ones that would pin a much larger parent
+ * are copied out; the rest are views sharing the parent's bytes. */
+static Object *new_substring(Object *string, int first_char, int offset, int length, int chars)
+{
+    if (length <= OBJECT_SMALL_MAX)
+    {
+        return new_string(string_object_bytes(string) + offset, length);
+    }
+
+    /* View the flat string underneath rather than a view or a rope */
+    if (string->flags & OBJECT_STRING_VIEW)
+    {
+        first_char += string->value.view->first_char;
+        offset += string->value.view->offset;
+        string = string->value.view->parent;
+    }
+    string_flatten(string);
+
+    int parent_length = string_object_length(string);
+    if (parent_length >= STRING_VIEW_PIN_BYTES && parent_length / STRING_VIEW_PIN_RATIO >= length)
+    {
+        Object *copy = new_string(string_object_bytes(string) + offset, length);
+        copy->value.string->chars = chars;
+        return copy;
+    }
+
+    StringView *view = gc_alloc_payload(sizeof(StringView));
+    view->parent = string;
+    view->offset = offset;
+    view->first_char = first_char;
+    view->length = length;
+    view->chars = chars;
+
+    Object *obj = gc_alloc_object();
+    obj->type = OBJECT_STRING;
+    obj->value.view = view;
+    obj->flags = OBJECT_STRING_VIEW;
+    return obj;
+}
+
+/* Code points [start, end) of a string; the bounds are checked by the caller */
+static Object *string_range(Object *string, int64_t start, int64_t end)
+{
+    int from = string_object_offset(string, (int)start);
+    int to = string_object_offset(string, (int)end);
+    return new_substring(string, (int)start, from, to - from, (int)(end - start));
+}
+
+static Object *builtin_substring(Object **args, int arg_count)
+{
+    (void)arg_count;
+    int64_t chars = string_object_chars(args[0]);
+    int64_t start = args[1]->value.integer;
+    int64_t count = args[2]->value.integer;
+
+    if (start < 0 || count < 0 || start > chars || count > chars - start)
+    {
+        return runtime_error("substring(%lld, %lld) out of range for a string of length %lld",
+                             (long long)start, (long long)count, (long long)chars);
+    }
+    return string_range(args[0], start, start + count);
+}
+
+static Object *builtin_slice(Object **args, int arg_count)
+{
+    (void)arg_count;
+    int64_t chars = string_object_chars(args[0]);
+    int64_t start = args[1]->value.integer;
+    int64_t end = args[2]->value.integer;
+
+    if (start < 0 || end < start || end > chars)
+    {
+        return runtime_error("slice(%lld, %lld) out of range for a string of length %lld",
+                             (long long)start, (long long)end, (long long)chars);
+    }
+    return string_range(args[0], start, end);
+}
+
+static Object *builtin_char_at(Object **args, int arg_count)
+{
+    (void)arg_count;
+    int64_t chars = string_object_chars(args[0]);
+    int64_t index = args[1]->value.integer;
+
+    if (index < 0 || index >= chars)
+    {
+        return runtime_error("char_at(%lld) out of range for a string of length %lld",
+                             (long long)index, (long long)chars);
+    }
+    return string_range(args[0], index, index + 1);
+}
+
+static Object *new_hash(int count)
+{
+    HashTable *table = hash_table_new(count);
+
+    Object *hash = gc_alloc_object();
+    hash->type = OBJECT_HASH;
+    hash->value.hash = table;
+    return hash;
+}
+
+static Object *builtin_get(Object **args, int arg_count)
+{
+    (void)arg_count;
+    Object *value = hash_get(args[0], args[1]);
+    return value != NULL ? value : NULL_OBJ;
+}
+
+static Object *builtin_set(Object **args, int arg_count)
+{
+    (void)arg_count;
+    hash_set(args[0], args[1], args[2]);
+    return args[0];
+}
+
+static Object *builtin_has(Object **args, int arg_count)
+{
+    (void)arg_count;
+    return hash_get(args[0], args[1]) != NULL ? TRUE_OBJ : FALSE_OBJ;
+}
+
+static Object *builtin_delete(Object **args, int arg_count)
+{
+    (void)arg_count;
+    Object *value = hash_delete(args[0], args[1]);
+    return value != NULL ? value : NULL_OBJ;
+}
+
+static Object *builtin_keys(Object **args, int arg_count)
+{
+    (void)arg_count;
+    HashTable *table = args[0]->value.hash;
+
+    /* Integer keys alone make an unboxed array, as an all-integer literal does */
+    int ints = 1;
+    for (int i = 0; i < table->capacity; i++)
+    {
+        if (table->entries[i].value != NULL && table->entries[i].key_type != OBJECT_INTEGER)
         {
-            return runtime_error("push() failed to allocate memory for array expansion");
+            ints = 0;
+            break;
         }
+    }
 
-        arr->value.array.elements = new_elements;
-        arr->value.array.capacity = new_capacity;
+    Object *arr = new_array(table->count, ints);
+    ArrayStorage *storage = arr->value.array;
+    if (ints)
+    {
+        for (int i = 0; i < table->capacity; i++)
+        {
+            if (table->entries[i].value != NULL)
+            {
+                ARRAY_INTS(storage)[storage->length++] = table->entries[i].key.scalar;
+            }
+        }
+        return arr;
     }
 
-    /* Add the new element */
-    arr->value.array.elements[arr->value.array.length] = value;
-    arr->value.array.length++;
+    /* Boxing an integer key allocates, so the array is rooted. The table
+     * only moves when the hash is written, so it stays put meanwhile. */
+    int scope = gc_root_scope();
+    gc_push_root(arr);
+    for (int i = 0; i < table->capacity; i++)
+    {
+        HashEntry *entry = &table->entries[i];
+        if (entry->value == NULL)
+        {
+            continue;
+        }
 
+        Object *key = entry->key.string;
+        if (entry->key_type == OBJECT_INTEGER)
+        {
+            key = new_integer(entry->key.scalar);
+        }
+        else if (entry->key_type == OBJECT_BOOLEAN)
+        {
+            key = entry->key.scalar ? TRUE_OBJ : FALSE_OBJ;
+        }
+
+        gc_lock_object(arr);
+        storage->elements[storage->length] = key;
+        gc_write_barrier(arr, storage->length, NULL, key);
+        storage->length++;
+        gc_unlock_object(arr);
+    }
+    gc_restore_roots(scope);
     return arr;
 }
 
-static Object *builtin_pop(Object **args, int arg_count)
+/* The integers of an array for the numeric built-ins: an unboxed array's
+ * own buffer, or a boxed one's elements copied into `*scratch` (for the
+ * caller to free) if all of them are integers. NULL if any is not. */
+static const int64_t *array_int_values(Object *arr, int64_t **scratch)
 {
-    if (arg_count != 1)
+    ArrayStorage *storage = arr->value.array;
+    *scratch = NULL;
+    if (arr->flags & OBJECT_ARRAY_INTS)
     {
-        return runtime_error("pop() takes exactly 1 argument (array), got %d", arg_count);
+        return ARRAY_INTS(storage);
     }
 
-    Object *arr = args[0];
+    int64_t *values = malloc(sizeof(int64_t) * (size_t)(storage->length > 0 ? storage->length : 1));
+    if (values == NULL)
+    {
+        fprintf(stderr, "Failed to allocate array values\n");
+        exit(1);
+    }
+    for (int i = 0; i < storage->length; i++)
+    {
+        if (storage->elements[i]->type != OBJECT_INTEGER)
+        {
+            free(values);
+            return NULL;
+        }
+        values[i] = storage->elements[i]->value.integer;
+    }
+    *scratch = values;
+    return values;
+}
 
-    if (arr->type != OBJECT_ARRAY)
+static Object *not_int_array_error(const char *name)
+{
+    return runtime_error("%s() requires an array of integers", name);
+}
+
+static Object *builtin_sum(Object **args, int arg_count)
+{
+    (void)arg_count;
+    int64_t *scratch;
+    const int64_t *values = array_int_values(args[0], &scratch);
+    if (values == NULL)
     {
-        return runtime_error("pop() requires ARRAY as argument, got %s", type_name(arr->type));
+        return not_int_array_error("ผลรวม");
     }
 
-    if (arr->value.array.length == 0)
+    int64_t sum = numeric_sum(values, args[0]->value.array->length);
+    free(scratch);
+    return new_integer(sum);
+}
+
+/* min() and max() */
+static Object *array_extreme(Object *arr, const char *name, int64_t (*kernel)(const int64_t *, int))
+{
+    if (arr->value.array->length == 0)
     {
-        return runtime_error("pop() called on empty array");
+        return runtime_error("%s() called on empty array", name);
     }
 
-    /* Get the last element */
-    Object *popped = arr->value.array.elements[arr->value.array.length - 1];
-    arr->value.array.length--;
+    int64_t *scratch;
+    const int64_t *values = array_int_values(arr, &scratch);
+    if (values == NULL)
+    {
+        return not_int_array_error(name);
+    }
 
-    return popped;
+    int64_t result = kernel(values, arr->value.array->length);
+    free(scratch);
+    return new_integer(result);
+}
+
+static Object *builtin_min(Object **args, int arg_count)
+{
+    (void)arg_count;
+    return array_extreme(args[0], "min", numeric_min);
+}
+
+static Object *builtin_max(Object **args, int arg_count)
+{
+    (void)arg_count;
+    return array_extreme(args[0], "max", numeric_max);
+}
+
+static Object *builtin_dot(Object **args, int arg_count)
+{
+    (void)arg_count;
+    int length = args[0]->value.array->length;
+    if (args[1]->value.array->length != length)
+    {
+        return runtime_error("dot() requires arrays of equal length, got %d and %d",
+                             length, args[1]->value.array->length);
+    }
+
+    int64_t *scratch_a;
+    int64_t *scratch_b;
+    const int64_t *a = array_int_values(args[0], &scratch_a);
+    const int64_t *b = a != NULL ? array_int_values(args[1], &scratch_b) : NULL;
+    if (b == NULL)
+    {
+        free(scratch_a);
+        return not_int_array_error("dot");
+    }
+
+    int64_t dot = numeric_dot(a, b, length);
+    free(scratch_a);
+    free(scratch_b);
+    return new_integer(dot);
+}
+
+/* add(a, b): a new array of the element-wise sums */
+static Object *builtin_add(Object **args, int arg_count)
+{
+    (void)arg_count;
+    int length = args[0]->value.array->length;
+    if (args[1]->value.array->length != length)
+    {
+        return runtime_error("add() requires arrays of equal length, got %d and %d",
+                             length, args[1]->value.array->length);
+    }
+
+    int64_t *scratch_a;
+    int64_t *scratch_b;
+    const int64_t *a = array_int_values(args[0], &scratch_a);
+    const int64_t *b = a != NULL ? array_int_values(args[1], &scratch_b) : NULL;
+    if (b == NULL)
+    {
+        free(scratch_a);
+        return not_int_array_error("add");
+    }
+
+    /* Allocating frees no payload the operands still use: they are rooted */
+    Object *result = new_array(length, 1);
+    numeric_add(ARRAY_INTS(result->value.array), a, b, length);
+    result->value.array->length = length;
+    free(scratch_a);
+    free(scratch_b);
+    return result;
+}
+
+/* scale(a, factor): a new array of each element times `factor` */
+static Object *builtin_scale(Object **args, int arg_count)
+{
+    (void)arg_count;
+    int length = args[0]->value.array->length;
+
+    int64_t *scratch;
+    const int64_t *values = array_int_values(args[0], &scratch);
+    if (values == NULL)
+    {
+        return not_int_array_error("scale");
+    }
+
+    Object *result = new_array(length, 1);
+    numeric_scale(ARRAY_INTS(result->value.array), values, args[1]->value.integer, length);
+    result->value.array->length = length;
+    free(scratch);
+    return result;
 }
 
+#define HASH_KEY_TYPES (TYPE_MASK(OBJECT_STRING) | TYPE_MASK(OBJECT_INTEGER) | TYPE_MASK(OBJECT_BOOLEAN))
+
+/* Builtin registry: arity and argument types are declared here once */
+static const Builtin BUILTINS[] = {
+    {"แสดง", builtin_print, BUILTIN_VARIADIC, {0}},
+    {"len", builtin_len, 1, {TYPE_MASK(OBJECT_STRING) | TYPE_MASK(OBJECT_ARRAY) | TYPE_MASK(OBJECT_HASH)}},
+    {"push", builtin_push, 2, {TYPE_MASK(OBJECT_ARRAY), TYPE_ANY}},
+    {"pop", builtin_pop, 1, {TYPE_MASK(OBJECT_ARRAY)}},
+    {"substring", builtin_substring, 3,
+     {TYPE_MASK(OBJECT_STRING), TYPE_MASK(OBJECT_INTEGER), TYPE_MASK(OBJECT_INTEGER)}},
+    {"slice", builtin_slice, 3,
+     {TYPE_MASK(OBJECT_STRING), TYPE_MASK(OBJECT_INTEGER), TYPE_MASK(OBJECT_INTEGER)}},
+    {"char_at", builtin_char_at, 2, {TYPE_MASK(OBJECT_STRING), TYPE_MASK(OBJECT_INTEGER)}},
+    {"get", builtin_get, 2, {TYPE_MASK(OBJECT_HASH), HASH_KEY_TYPES}},
+    {"set", builtin_set, 3, {TYPE_MASK(OBJECT_HASH), HASH_KEY_TYPES, TYPE_ANY}},
+    {"has", builtin_has, 2, {TYPE_MASK(OBJECT_HASH), HASH_KEY_TYPES}},
+    {"delete", builtin_delete, 2, {TYPE_MASK(OBJECT_HASH), HASH_KEY_TYPES}},
+    {"keys", builtin_keys, 1, {TYPE_MASK(OBJECT_HASH)}},
+    {"ผลรวม", builtin_sum, 1, {TYPE_MASK(OBJECT_ARRAY)}},
+    {"min", builtin_min, 1, {TYPE_MASK(OBJECT_ARRAY)}},
+    {"max", builtin_max, 1, {TYPE_MASK(OBJECT_ARRAY)}},
+    {"dot", builtin_dot, 2, {TYPE_MASK(OBJECT_ARRAY), TYPE_MASK(OBJECT_ARRAY)}},
+    {"add", builtin_add, 2, {TYPE_MASK(OBJECT_ARRAY), TYPE_MASK(OBJECT_ARRAY)}},
+    {"scale", builtin_scale, 2, {TYPE_MASK(OBJECT_ARRAY), TYPE_MASK(OBJECT_INTEGER)}},
+};
+
+#define BUILTIN_COUNT ((int)(sizeof(BUILTINS) / sizeof(BUILTINS[0])))
+
 void init_evaluator()
 {
     TRUE_OBJ = gc_alloc_object();
@@ -298,29 +828,74 @@ void init_evaluator()
     NULL_OBJ->type = OBJECT_NULL;
     gc_register_singleton(NULL_OBJ);
 
+    numeric_init();
+
     GLOBAL_ENV = new_environment();
-    gc_set_global_env(GLOBAL_ENV);
+    ROOT_ENV = GLOBAL_ENV;
+    gc_set_global_env(ROOT_ENV);
 
     /* Register built-in functions */
-    Object *print_obj = gc_alloc_object();
-    print_obj->type = OBJECT_BUILTIN;
-    print_obj->value.builtin = builtin_print;
-    environment_set(GLOBAL_ENV, "แสดง", print_obj);
+    for (int i = 0; i < BUILTIN_COUNT; i++)
+    {
+        Object *builtin_obj = gc_alloc_object();
+        builtin_obj->type = OBJECT_BUILTIN;
+        builtin_obj->value.builtin = &BUILTINS[i];
+        environment_set(GLOBAL_ENV, (char *)BUILTINS[i].name, builtin_obj);
+    }
+}
+
+/* Describe a TYPE_MASK set for error messages, e.g. "STRING or ARRAY" */
+static void describe_type_mask(unsigned int mask, char *buffer, size_t size)
+{
+    buffer[0] = '\0';
+    for (int type = OBJECT_INTEGER; type <= OBJECT_ERROR; type++)
+    {
+        if (mask & TYPE_MASK(type))
+        {
+            size_t used = strlen(buffer);
+            snprintf(buffer + used, size - used, "%s%s", used > 0 ? " or " : "",
+                     type_name((ObjectType)type));
+        }
+    }
+}
+
+static Object *apply_builtin(const Builtin *builtin, Expression **args, int arg_count)
+{
+    /* Arity is part of the declaration, so reject before evaluating anything */
+    if (builtin->arity != BUILTIN_VARIADIC && arg_count != builtin->arity)
+    {
+        return runtime_error("%s() takes exactly %d argument%s, got %d", builtin->name,
+                             builtin->arity, builtin->arity == 1 ? "" : "s", arg_count);
+    }
+
+    /* Evaluate arguments onto the GC's root stack, which doubles as the
+     * operand stack: a nested call claims the slots above ours */
+    int scope = gc_root_scope();
+    for (int i = 0; i < arg_count; i++)
+    {
+        Object *arg = eval((Node *)args[i]);
+        if (arg->type == OBJECT_ERROR)
+        {
+            gc_restore_roots(scope);
+            return arg;
+        }
 
-    Object *len_obj = gc_alloc_object();
-    len_obj->type = OBJECT_BUILTIN;
-    len_obj->value.builtin = builtin_len;
-    environment_set(GLOBAL_ENV, "len", len_obj);
+        if (i < BUILTIN_MAX_PARAMS && builtin->arity != BUILTIN_VARIADIC &&
+            !(builtin->param_types[i] & TYPE_MASK(arg->type)))
+        {
+            char expected[128];
+            describe_type_mask(builtin->param_types[i], expected, sizeof(expected));
+            gc_restore_roots(scope);
+            return runtime_error("%s() requires %s as argument %d, got %s", builtin->name,
+                                 expected, i + 1, type_name(arg->type));
+        }
 
-    Object *push_obj = gc_alloc_object();
-    push_obj->type = OBJECT_BUILTIN;
-    push_obj->value.builtin = builtin_push;
-    environment_set(GLOBAL_ENV, "push", push_obj);
+        gc_push_root(arg);
+    }
 
-    Object *pop_obj = gc_alloc_object();
-    pop_obj->type = OBJECT_BUILTIN;
-    pop_obj->value.builtin = builtin_pop;
-    environment_set(GLOBAL_ENV, "pop", pop_obj);
+    Object *result = builtin->fn(gc_root_slots(scope), arg_count);
+    gc_restore_roots(scope);
+    return result;
 }
 
 static Object *apply_function(Node *call_node, Object *fn, Expression **args, int arg_count)
@@ -332,21 +907,7 @@ static Object *apply_function(Node *call_node, Object *fn, Expression **args, in
 
     if (fn->type == OBJECT_BUILTIN)
     {
-        /* Evaluate arguments */
-        Object **evaluated_args = malloc(sizeof(Object *) * arg_count);
-        for (int i = 0; i < arg_count; i++)
-        {
-            evaluated_args[i] = eval((Node *)args[i]);
-            if (evaluated_args[i]->type == OBJECT_ERROR)
-            {
-                Object *err = evaluated_args[i];
-                free(evaluated_args);
-                return err;
-            }
-        }
-        Object *result = fn->value.builtin(evaluated_args, arg_count);
-        free(evaluated_args);
-        return result;
+        return apply_builtin(fn->value.builtin, args, arg_count);
     }
 
     if (fn->type != OBJECT_FUNCTION)
@@ -354,41 +915,47 @@ static Object *apply_function(Node *call_node, Object *fn, Expression **args, in
         return runtime_error("not a function: %s", type_name(fn->type));
     }
 
+    FunctionLiteral *literal = fn->value.function->literal;
+
     /* Check argument count */
-    if (arg_count != fn->value.function.parameter_count)
+    if (arg_count != literal->parameter_count)
     {
         char message[256];
         char label[128];
         snprintf(message, sizeof(message), "wrong number of arguments: expected %d, got %d",
-                 fn->value.function.parameter_count, arg_count);
-        snprintf(label, sizeof(label), "expected %d argument(s)", fn->value.function.parameter_count);
+                 literal->parameter_count, arg_count);
+        snprintf(label, sizeof(label), "expected %d argument(s)", literal->parameter_count);
         return runtime_error_at(call_node, "E005", message, label, NULL);
     }
 
-    Environment *extended_env = new_environment();
-    extended_env->outer = fn->value.function.env;
+    Environment *extended_env = new_frame(fn->value.function->env, literal->frame_size);
     gc_push_env(extended_env);
 
+    Object *result = NULL;
     for (int i = 0; i < arg_count; i++)
     {
         Object *evaluated_arg = eval((Node *)args[i]);
         if (evaluated_arg->type == OBJECT_ERROR)
         {
-            gc_pop_env();
-            return evaluated_arg;
+            result = evaluated_arg;
+            break;
         }
-        environment_set(extended_env, fn->value.function.parameters[i]->value, evaluated_arg);
+        environment_set(extended_env, literal->parameters[i]->value, evaluated_arg);
     }
 
-    Object *result = eval_block_statement_with_env(fn->value.function.body, extended_env);
+    if (result == NULL)
+    {
+        FunctionLiteral *old_function = CURRENT_FUNCTION;
+        CURRENT_FUNCTION = literal;
+        result = eval_block_statement_with_env(literal->body, extended_env);
+        CURRENT_FUNCTION = old_function;
+    }
 
     gc_pop_env();
+    release_frame(extended_env);
 
-    /* Unwrap return value */
-    if (result != NULL && result->type == OBJECT_RETURN_VALUE)
-    {
-        return result->value.return_value;
-    }
+    /* The return (if any) ends here */
+    EVAL_SIGNAL = SIGNAL_NONE;
 
     return result;
 }
@@ -405,12 +972,10 @@ static Object *eval_block_statement_with_env(BlockStatement *block, Environment
     {
         result = eval((Node *)block->statements[i]);
 
-        /* If we hit a return statement, unwrap it and propagate */
-        if (result != NULL && result->type == OBJECT_RETURN_VALUE)
+        /* If we hit a return statement, propagate it */
+        if (EVAL_SIGNAL != SIGNAL_NONE)
         {
-            gc_pop_env();
-            GLOBAL_ENV = old_env;
-            return result;
+            break;
         }
     }
 
@@ -496,19 +1061,20 @@ static Object *eval_integer_infix_expression(const char *operator, Object *left,
     Object *obj = gc_alloc_object();
     obj->type = OBJECT_INTEGER;
 
+    /* Overflow wraps, as it does in the numeric built-ins' kernels */
     if (strcmp(operator, "+") == 0)
     {
-        obj->value.integer = left_val + right_val;
+        obj->value.integer = (int64_t)((uint64_t)left_val + (uint64_t)right_val);
         return obj;
     }
     if (strcmp(operator, "-") == 0)
     {
-        obj->value.integer = left_val - right_val;
+        obj->value.integer = (int64_t)((uint64_t)left_val - (uint64_t)right_val);
         return obj;
     }
     if (strcmp(operator, "*") == 0)
     {
-        obj->value.integer = left_val * right_val;
+        obj->value.integer = (int64_t)((uint64_t)left_val * (uint64_t)right_val);
         return obj;
     }
     if (strcmp(operator, "/") == 0)
@@ -530,6 +1096,8 @@ static Object *eval_integer_infix_expression(const char *operator, Object *left,
                          type_name(OBJECT_INTEGER), operator, type_name(OBJECT_INTEGER));
 }
 
+static Object *eval_infix_operands(InfixExpression *exp, Object *left, Object *right);
+
 static Object *eval_infix_expression(InfixExpression *exp)
 {
     Object *left = eval((Node *)exp->left);
@@ -538,12 +1106,70 @@ static Object *eval_infix_expression(InfixExpression *exp)
         return left;
     }
 
-    Object *right = eval((Node *)exp->right);
-    if (right->type == OBJECT_ERROR)
+    /* Both operands stay rooted until the result exists */
+    int scope = gc_root_scope();
+    gc_push_root(left);
+
+    Object *result = eval((Node *)exp->right);
+    if (result->type != OBJECT_ERROR)
     {
-        return right;
+        gc_push_root(result);
+        result = eval_infix_operands(exp, left, result);
     }
 
+    gc_restore_roots(scope);
+    return result;
+}
+
+/* Short results are copied flat (inline when they fit); longer ones become
+ * a rope over the two operands, so a loop appending to a string does not
+ * copy it every time */
+static Object *eval_string_concat(Object *left, Object *right)
+{
+    int left_length = string_object_length(left);
+    int length = left_length + string_object_length(right);
+
+    if (length <= OBJECT_SMALL_MAX)
+    {
+        char bytes[OBJECT_SMALL_MAX];
+        memcpy(bytes, string_object_bytes(left), left_length);
+        memcpy(bytes + left_length, string_object_bytes(right), length - left_length);
+        return new_string(bytes, length);
+    }
+
+    if (length < ROPE_MIN_LENGTH)
+    {
+        String *result = gc_alloc_payload(STRING_BYTES(length));
+        result->length = length;
+        result->chars = -1;
+        result->hash = 0;
+        result->crumbs = NULL;
+        memcpy(result->data, string_object_bytes(left), left_length);
+        memcpy(result->data + left_length, string_object_bytes(right), length - left_length);
+        result->data[length] = '\0';
+
+        Object *obj = gc_alloc_object();
+        obj->type = OBJECT_STRING;
+        obj->value.string = result;
+        obj->flags = OBJECT_STRING_OWNED;
+        return obj;
+    }
+
+    Rope *rope = gc_alloc_payload(sizeof(Rope));
+    rope->length = length;
+    rope->chars = string_object_chars(left) + string_object_chars(right);
+    rope->left = left;
+    rope->right = right;
+
+    Object *obj = gc_alloc_object();
+    obj->type = OBJECT_STRING;
+    obj->value.rope = rope;
+    obj->flags = OBJECT_STRING_ROPE;
+    return obj;
+}
+
+static Object *eval_infix_operands(InfixExpression *exp, Object *left, Object *right)
+{
     if (left->type == OBJECT_INTEGER && right->type == OBJECT_INTEGER)
     {
         return eval_integer_infix_expression(exp->operator, left, right);
@@ -553,28 +1179,17 @@ static Object *eval_infix_expression(InfixExpression *exp)
     {
         if (strcmp(exp->operator, "+") == 0)
         {
-            /* String concatenation */
-            int len1 = strlen(left->value.string.data);
-            int len2 = strlen(right->value.string.data);
-            char *result = malloc(len1 + len2 + 1);
-            strcpy(result, left->value.string.data);
-            strcat(result, right->value.string.data);
-
-            Object *obj = gc_alloc_object();
-            obj->type = OBJECT_STRING;
-            obj->value.string.data = result;
-            obj->value.string.owned = 1;
-            return obj;
+            return eval_string_concat(left, right);
         }
 
         if (strcmp(exp->operator, "==") == 0)
         {
-            return strcmp(left->value.string.data, right->value.string.data) == 0 ? TRUE_OBJ : FALSE_OBJ;
+            return string_object_equals(left, right) ? TRUE_OBJ : FALSE_OBJ;
         }
 
         if (strcmp(exp->operator, "!=") == 0)
         {
-            return strcmp(left->value.string.data, right->value.string.data) != 0 ? TRUE_OBJ : FALSE_OBJ;
+            return !string_object_equals(left, right) ? TRUE_OBJ : FALSE_OBJ;
         }
 
         return runtime_error("unknown operator: %s %s %s",
@@ -664,6 +1279,7 @@ static Object *eval_integer_literal(IntegerLiteral *literal)
 static Object *eval_while_statement(WhileStatement *stmt)
 {
     Object *result = NULL_OBJ;
+    int scope = gc_root_scope();
 
     while (1)
     {
@@ -675,13 +1291,18 @@ static Object *eval_while_statement(WhileStatement *stmt)
 
         result = eval_block_statement(stmt->body);
 
-        /* If result is a return value, break out of the loop */
-        if (result != NULL && result->type == OBJECT_RETURN_VALUE)
+        /* A return inside the body ends the loop */
+        if (EVAL_SIGNAL != SIGNAL_NONE)
         {
             break;
         }
+
+        /* The loop's value must survive the next condition */
+        gc_restore_roots(scope);
+        gc_push_root(result);
     }
 
+    gc_restore_roots(scope);
     return result;
 }
 
@@ -701,7 +1322,10 @@ static Object *eval_for_statement(ForStatement *stmt)
     }
 
     // Evaluate end expression
+    int scope = gc_root_scope();
+    gc_push_root(start_obj);
     Object *end_obj = eval((Node *)stmt->end);
+    gc_restore_roots(scope);
     if (end_obj->type == OBJECT_ERROR)
     {
         return end_obj;
@@ -711,19 +1335,18 @@ static Object *eval_for_statement(ForStatement *stmt)
         return runtime_error("for loop end value must be INTEGER, got %s", type_name(end_obj->type));
     }
 
+    // Unbox the bounds: the body may collect start_obj and end_obj, and the
+    // only object this frame holds across a body evaluation is the rooted result
     int64_t start_val = start_obj->value.integer;
     int64_t end_val = end_obj->value.integer;
 
-    // Set loop variable to start value
-    Object *loop_var = gc_alloc_object();
-    loop_var->type = OBJECT_INTEGER;
-    loop_var->value.integer = start_val;
-    environment_set(GLOBAL_ENV, stmt->variable->value, loop_var);
-
-    // Loop: i < end (exclusive) or i <= end (inclusive)
-    while (1)
+    // Loop: i < end (exclusive) or i <= end (inclusive). The counter lives
+    // here; each iteration binds a fresh integer, so a body that rebinds or
+    // captures the variable never shares an object with the loop.
+    for (int64_t current = start_val;; current++)
     {
-        int64_t current = loop_var->value.integer;
+        // Bound even for the final check, so it holds the end value after the loop
+        environment_set(GLOBAL_ENV, stmt->variable->value, new_integer(current));
 
         // Check loop condition
         int should_continue = stmt->inclusive ? (current <= end_val) : (current < end_val);
@@ -736,27 +1359,210 @@ static Object *eval_for_statement(ForStatement *stmt)
         result = eval_block_statement(stmt->body);
 
         // Handle return statements
-        if (result != NULL && result->type == OBJECT_RETURN_VALUE)
+        if (EVAL_SIGNAL != SIGNAL_NONE)
         {
             break;
         }
 
-        // Increment loop variable
-        loop_var->value.integer++;
+        // Keep the loop's value rooted through the next iteration
+        gc_restore_roots(scope);
+        gc_push_root(result);
     }
 
+    gc_restore_roots(scope);
     return result;
 }
 
+/* Literals are interned: every evaluation of equal literals yields the same
+ * object for as long as it stays alive */
 static Object *eval_string_literal(StringLiteral *literal)
 {
-    Object *obj = gc_alloc_object();
-    obj->type = OBJECT_STRING;
-    obj->value.string.data = literal->value;
-    obj->value.string.owned = 0; /* Borrowed from AST, don't free */
+    String *value = literal->value;
+    uint32_t hash = string_hash(value);
+
+    Object *obj = gc_intern_find(value->data, value->length, hash);
+    if (obj != NULL)
+    {
+        return obj;
+    }
+
+    /* A short literal is copied inline rather than pointed at */
+    if (value->length <= OBJECT_SMALL_MAX)
+    {
+        obj = new_string(value->data, value->length);
+    }
+    else
+    {
+        obj = gc_alloc_object();
+        obj->type = OBJECT_STRING;
+        obj->value.string = value; /* Borrowed from AST, don't free */
+    }
+
+    obj->flags |= OBJECT_STRING_INTERNED;
+    gc_intern_add(obj, hash);
     return obj;
 }
 
+/* Elements wait on the root stack until they are all known, and are stored
+ * unboxed if every one is an integer */
+static Object *eval_array_literal(ArrayLiteral *literal)
+{
+    int scope = gc_root_scope();
+    int ints = 1;
+
+    for (int i = 0; i < literal->element_count; i++)
+    {
+        Object *elem = eval((Node *)literal->elements[i]);
+        if (elem->type == OBJECT_ERROR)
+        {
+            gc_restore_roots(scope);
+            return elem;
+        }
+        if (elem->type != OBJECT_INTEGER)
+        {
+            ints = 0;
+        }
+        gc_push_root(elem);
+    }
+
+    Object *arr = new_array(literal->element_count, ints);
+    ArrayStorage *storage = arr->value.array;
+    Object **elements = gc_root_slots(scope);
+
+    for (int i = 0; i < literal->element_count; i++)
+    {
+        if (ints)
+        {
+            ARRAY_INTS(storage)[i] = elements[i]->value.integer;
+        }
+        else
+        {
+            storage->elements[i] = elements[i];
+            gc_write_barrier(arr, i, NULL, elements[i]);
+        }
+    }
+    storage->length = literal->element_count;
+
+    gc_restore_roots(scope);
+    return arr;
+}
+
+static Object *eval_hash_literal(HashLiteral *literal)
+{
+    Object *hash = new_hash(literal->pair_count);
+
+    /* The hash is rooted while its pairs are evaluated, and each key while
+     * its value is */
+    int scope = gc_root_scope();
+    gc_push_root(hash);
+
+    for (int i = 0; i < literal->pair_count; i++)
+    {
+        Object *key = eval((Node *)literal->keys[i]);
+        if (key->type == OBJECT_ERROR)
+        {
+            gc_restore_roots(scope);
+            return key;
+        }
+        if (!hash_key_valid(key))
+        {
+            gc_restore_roots(scope);
+            return runtime_error("unusable as hash key: %s", type_name(key->type));
+        }
+        gc_push_root(key);
+
+        Object *value = eval((Node *)literal->values[i]);
+        if (value->type == OBJECT_ERROR)
+        {
+            gc_restore_roots(scope);
+            return value;
+        }
+        hash_set(hash, key, value);
+        gc_restore_roots(scope + 1);
+    }
+
+    gc_restore_roots(scope);
+    return hash;
+}
+
+static int is_boxed_name(FunctionLiteral *function, const char *name)
+{
+    for (int i = 0; i < function->boxed_count; i++)
+    {
+        if (strcmp(function->boxed_names[i], name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static Object *new_cell(Object *value)
+{
+    Object *cell = gc_alloc_object();
+    cell->type = OBJECT_CELL;
+    cell->value.cell = value;
+    return cell;
+}
+
+/* Build a closure. Top-level functions just use the root scope. Inside a
+ * call, the closure gets a small environment holding only the free names the
+ * current frame binds: a copy of the value, or the shared cell when the
+ * enclosing function may rebind it later. Other names resolve through the
+ * enclosing function's own captured environment, then the root scope. */
+static Object *eval_function_literal(FunctionLiteral *literal)
+{
+    Environment *env = ROOT_ENV;
+
+    if (GLOBAL_ENV != ROOT_ENV)
+    {
+        Environment *frame = GLOBAL_ENV;
+        env = gc_alloc_env();
+        env->outer = frame->outer;
+
+        /* Keep the half-built environment rooted while cells are allocated */
+        gc_push_env(env);
+
+        for (int i = 0; i < literal->free_count; i++)
+        {
+            char *name = literal->free_names[i];
+            int boxed = CURRENT_FUNCTION != NULL && is_boxed_name(CURRENT_FUNCTION, name);
+            Environment_Binding *binding = environment_find(frame, name);
+
+            if (binding == NULL)
+            {
+                if (!boxed)
+                {
+                    continue;
+                }
+                /* A local bound later in this call: share an empty cell now */
+                environment_set(frame, name, new_cell(NULL));
+                binding = environment_find(frame, name);
+            }
+            else if (boxed && (binding->value == NULL || binding->value->type != OBJECT_CELL))
+            {
+                binding->value = new_cell(binding->value);
+            }
+
+            environment_set(env, name, binding->value);
+        }
+    }
+
+    Closure *closure = gc_alloc_payload(sizeof(Closure));
+    closure->literal = literal;
+    closure->env = env;
+
+    Object *fn = gc_alloc_object();
+    fn->type = OBJECT_FUNCTION;
+    fn->value.function = closure;
+
+    if (env != ROOT_ENV)
+    {
+        gc_pop_env();
+    }
+    return fn;
+}
+
 Object *eval(Node *node)
 {
     switch (node->type)
@@ -778,19 +1584,18 @@ Object *eval(Node *node)
     case NODE_IF_EXPRESSION:
         return eval_if_expression((IfExpression *)node);
     case NODE_FUNCTION_LITERAL:
-    {
-        Object *fn = gc_alloc_object();
-        fn->type = OBJECT_FUNCTION;
-        fn->value.function.parameters = ((FunctionLiteral *)node)->parameters;
-        fn->value.function.parameter_count = ((FunctionLiteral *)node)->parameter_count;
-        fn->value.function.body = ((FunctionLiteral *)node)->body;
-        fn->value.function.env = GLOBAL_ENV;
-        return fn;
-    }
+        return eval_function_literal((FunctionLiteral *)node);
     case NODE_CALL_EXPRESSION:
     {
         Object *fn = eval((Node *)((CallExpression *)node)->function);
-        return apply_function(node, fn, ((CallExpression *)node)->arguments, ((CallExpression *)node)->argument_count);
+
+        /* The callee may be a temporary too, e.g. a function returned by a call */
+        int scope = gc_root_scope();
+        gc_push_root(fn);
+        Object *result = apply_function(node, fn, ((CallExpression *)node)->arguments,
+                                        ((CallExpression *)node)->argument_count);
+        gc_restore_roots(scope);
+        return result;
     }
     case NODE_LET_STATEMENT:
     {
@@ -801,36 +1606,17 @@ Object *eval(Node *node)
     case NODE_RETURN_STATEMENT:
     {
         Object *val = eval((Node *)((ReturnStatement *)node)->return_value);
-        Object *return_obj = gc_alloc_object();
-        return_obj->type = OBJECT_RETURN_VALUE;
-        return_obj->value.return_value = val;
-        return return_obj;
+        EVAL_SIGNAL = SIGNAL_RETURN;
+        return val;
     }
     case NODE_WHILE_STATEMENT:
         return eval_while_statement((WhileStatement *)node);
     case NODE_FOR_STATEMENT:
         return eval_for_statement((ForStatement *)node);
     case NODE_ARRAY_LITERAL:
-    {
-        ArrayLiteral *arr_lit = (ArrayLiteral *)node;
-        Object *arr = gc_alloc_object();
-        arr->type = OBJECT_ARRAY;
-        arr->value.array.length = arr_lit->element_count;
-        arr->value.array.capacity = arr_lit->element_count > 0 ? arr_lit->element_count : 1;
-        arr->value.array.elements = malloc(sizeof(Object *) * arr->value.array.capacity);
-
-        /* Evaluate each element */
-        for (int i = 0; i < arr_lit->element_count; i++)
-        {
-            Object *elem = eval((Node *)arr_lit->elements[i]);
-            if (elem != NULL && elem->type == OBJECT_ERROR)
-            {
-                return elem;
-            }
-            arr->value.array.elements[i] = elem;
-        }
-        return arr;
-    }
+        return eval_array_literal((ArrayLiteral *)node);
+    case NODE_HASH_LITERAL:
+        return eval_hash_literal((HashLiteral *)node);
     case NODE_INDEX_EXPRESSION:
     {
         IndexExpression *idx_exp = (IndexExpression *)node;
@@ -840,40 +1626,69 @@ Object *eval(Node *node)
             return left;
         }
 
+        int scope = gc_root_scope();
+        gc_push_root(left);
         Object *index = eval((Node *)idx_exp->index);
+        gc_restore_roots(scope);
         if (index != NULL && index->type == OBJECT_ERROR)
         {
             return index;
         }
 
-        /* Validate left is an array */
-        if (left->type != OBJECT_ARRAY)
+        /* A missing key reads as null */
+        if (left->type == OBJECT_HASH)
+        {
+            if (!hash_key_valid(index))
+            {
+                return runtime_error("unusable as hash key: %s", type_name(index->type));
+            }
+            Object *value = hash_get(left, index);
+            return value != NULL ? value : NULL_OBJ;
+        }
+
+        /* Validate left is an array or a string */
+        if (left->type != OBJECT_ARRAY && left->type != OBJECT_STRING)
         {
             return runtime_error("index operator not supported for %s", type_name(left->type));
         }
+        const char *kind = left->type == OBJECT_ARRAY ? "array" : "string";
 
         /* Validate index is an integer */
         if (index->type != OBJECT_INTEGER)
         {
-            return runtime_error("array index must be INTEGER, got %s", type_name(index->type));
+            return runtime_error("%s index must be INTEGER, got %s", kind, type_name(index->type));
         }
 
         int64_t idx = index->value.integer;
+        int length = left->type == OBJECT_ARRAY ? left->value.array->length
+                                                : string_object_chars(left);
 
         /* Bounds checking */
-        if (idx < 0 || idx >= left->value.array.length)
+        if (idx < 0 || idx >= length)
         {
             char message[256];
             char label[128];
             snprintf(message, sizeof(message),
-                     "array index out of bounds: index %lld, but array has length %d",
-                     idx, left->value.array.length);
+                     "%s index out of bounds: index %lld, but %s has length %d",
+                     kind, idx, kind, length);
             snprintf(label, sizeof(label), "index %lld is invalid", idx);
             return runtime_error_at(node, "E002", message, label,
                                     "valid indices are from 0 to length-1");
         }
 
-        return left->value.array.elements[idx];
+        /* Strings index by code point, giving a one-character string */
+        if (left->type == OBJECT_STRING)
+        {
+            gc_push_root(left);
+            Object *result = string_range(left, idx, idx + 1);
+            gc_restore_roots(scope);
+            return result;
+        }
+        if (left->flags & OBJECT_ARRAY_INTS)
+        {
+            return new_integer(ARRAY_INTS(left->value.array)[idx]);
+        }
+        return left->value.array->elements[idx];
     }
     case NODE_EXPRESSION_STATEMENT:
         return eval((Node *)((ExpressionStatement *)node)->expression);
@@ -893,3 +1708,13 @@ Object *eval(Node *node)
         return NULL;
     }
 }
+
+Object *eval_statement(Node *node)
+{
+    Object *result = eval(node);
+
+    /* A return outside any function only ends the current statement */
+    EVAL_SIGNAL = SIGNAL_NONE;
+
+    return result;
+}
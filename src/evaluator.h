@@ -20,4 +20,7 @@ EvalContext *evaluator_get_context(void);
 /* Main evaluation function */
 Object *eval(Node *node);
 
+/* Evaluate a top-level statement, discarding any stray return signal */
+Object *eval_statement(Node *node);
+
 #endif // EVALUATOR_H
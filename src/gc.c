@@ -1,33 +1,392 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime, posix_memalign, pthreads */
+
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include "gc.h"
 #include "object.h"
 
-/* GC State */
-static Object *gc_objects = NULL;         /* Linked list of all allocated objects */
+/* GC State
+ *
+ * Objects live in fixed-size cells carved out of blocks aligned to
+ * GC_BLOCK_BYTES, so an object's block is found by masking its address.
+ * Objects carry no GC header: each block keeps side bitmaps of the cells in
+ * use, the mark bits and the old-generation bits. Allocation takes the next
+ * clear in-use bit. Sweeping combines bitmap words to find dead cells and only
+ * touches those, to release their payloads; live objects are not read.
+ *
+ * The heap has two generations, distinguished by the old bitmap rather than
+ * by where an object lives. A minor collection traces only young objects
+ * (old ones count as live) and sweeps just the blocks allocated into since the
+ * previous minor collection, promoting survivors in place. gc_write_barrier() records each
+ * slot of an old object that is given a young reference in the remembered
+ * set, and a minor collection treats those slots as extra roots. Recording
+ * the slot rather than the owner keeps a push onto a large old array from
+ * making every minor collection rescan the whole array.
+ *
+ * Collections are scheduled by heap size in bytes. A minor collection runs
+ * once the young generation holds `nursery_bytes`; a full cycle starts once
+ * the old generation reaches `growth_factor` times the bytes that survived
+ * the previous full cycle (never less than `min_heap_bytes`). With a soft
+ * limit set, the headroom shrinks as the heap approaches it.
+ *
+ * Closure environments follow the same split. A closure environment is only
+ * ever referenced by the function object created right after it, so no old
+ * object can point at a young environment and they need no barrier.
+ *
+ * The old generation is collected incrementally with a tri-colour
+ * snapshot-at-the-beginning scheme. Starting a cycle shades the roots gray;
+ * after that every GC_STEP_ALLOCS allocations the collector blackens up to
+ * GC_MARK_BUDGET gray objects. Objects allocated during marking are born
+ * black, and gc_write_barrier() shades any reference that is overwritten, so
+ * everything reachable when the cycle began stays reachable to the marker.
+ * Once the gray stack is empty, both generations are swept lazily in
+ * GC_SWEEP_BUDGET slices. Minor collections wait until the cycle finishes.
+ *
+ * With `background_sweep` set, that sweep runs on a thread of its own instead.
+ * Finishing marking detaches every block from the heap and hands the list to
+ * the sweeper, which owns those blocks until it passes them back: the
+ * evaluator only allocates from fresh blocks or ones the sweeper has put on
+ * the free list, and never reads an unswept block's bitmaps. What the sweeper
+ * frees and counts is kept in a GC_Sweep record and merged into the heap by
+ * the evaluator once the thread is done, so the payload allocator and the
+ * statistics stay single-threaded. Only the free and spare block lists are
+ * shared, under gc_heap_lock. */
+typedef enum
+{
+    GC_IDLE,
+    GC_MARKING,
+    GC_SWEEPING
+} GC_Phase;
+
+/* Upper bound on cells per block, for sizing the bitmaps */
+#define GC_BITMAP_WORDS ((GC_BLOCK_BYTES / sizeof(Object) + 63) / 64)
+
+typedef struct GC_Block
+{
+    struct GC_Block *next;       /* Every block, in allocation order */
+    struct GC_Block *next_free;  /* Blocks with free cells */
+    struct GC_Block *next_young; /* Blocks allocated into since the last minor GC */
+    int alloc_cursor;            /* No free cell below this index */
+    int live;                    /* Cells holding an object */
+    unsigned char on_free_list;
+    unsigned char on_young_list;
+    unsigned char unswept;       /* Owned by the running sweep; bitmaps off limits */
+    uint64_t in_use[GC_BITMAP_WORDS];
+    uint64_t marked[GC_BITMAP_WORDS];
+    uint64_t old[GC_BITMAP_WORDS];
+    Object cells[];
+} GC_Block;
+
+#define GC_BLOCK_CELLS ((int)((GC_BLOCK_BYTES - sizeof(GC_Block)) / sizeof(Object)))
+#define GC_BLOCK_WORDS ((GC_BLOCK_CELLS + 63) / 64)
+#define GC_REGION_BLOCKS 32
+
+static GC_Block *gc_blocks = NULL;        /* All blocks */
+static GC_Block *gc_free_blocks = NULL;   /* Blocks with reusable cells */
+static GC_Block *gc_young_blocks = NULL;  /* Blocks that may hold young objects */
+static GC_Block *gc_alloc_block = NULL;   /* Block currently being allocated from */
+static GC_Block *gc_spare_blocks = NULL;  /* Empty blocks kept for reuse */
 static int gc_num_objects = 0;            /* Current number of tracked objects */
-static int gc_alloc_count = 0;            /* Allocations since last GC */
-static GC_Stats gc_stats = {0, 0, 0};     /* Statistics */
+static size_t gc_young_bytes = 0;         /* Bytes allocated into the young generation */
+static size_t gc_old_bytes = 0;           /* Old cells and closure environments */
+static size_t gc_payload_bytes = 0;       /* Live string and element buffers */
+static size_t gc_live_bytes = 0;          /* Bytes that survived the last full cycle */
+static size_t gc_trigger_bytes = 0;       /* Old-generation size that starts a full cycle */
+static int gc_alloc_count = 0;            /* Allocations since last incremental step */
+static GC_Config gc_config;               /* Scheduling tunables */
+static int gc_minor = 0;                  /* Set while a minor collection is marking */
+static GC_Phase gc_phase = GC_IDLE;       /* Progress of the incremental full cycle */
+static GC_Stats gc_stats;                 /* Statistics */
 static Environment *gc_global_env = NULL; /* Root environment */
 
-/* Stack of temporary environments (for function calls, block scopes) */
-#define MAX_ENV_STACK 256
-static Environment *gc_env_stack[MAX_ENV_STACK];
+/* Mark stack of objects waiting to be traced. Objects are pushed unchecked
+ * and prefetched, and the mark bit is tested when they are popped, so the
+ * header load overlaps with tracing the rest of the stack. If the stack
+ * cannot grow, the object is marked without being queued and the collector
+ * later rescans the heap for marked objects whose children it missed. */
+typedef struct
+{
+    Object **items;
+    int count;
+    int capacity;
+    int overflow; /* Objects were marked without being queued */
+} GC_MarkStack;
+
+static GC_MarkStack gc_gray; /* The evaluator thread's mark stack */
+
+/* Parallel marking. Stop-the-world marking with `mark_threads` above 1 is
+ * shared between the evaluator thread and a pool of helper threads. The
+ * gray objects are dealt out across the workers, and each traces from a
+ * private stack. A worker with plenty of work and an empty shared queue
+ * moves half its stack there, and a worker that runs dry steals half of
+ * another worker's shared queue. Mark bits are set with an atomic
+ * fetch-or, and environments are claimed by swapping in the epoch, so each
+ * is traced by exactly one worker. Marking ends once every worker is idle
+ * with nothing left to steal. */
+#define GC_MAX_MARK_THREADS 64
+#define GC_MARK_SHARE_MIN 64        /* Private gray objects before sharing any */
+#define GC_PARALLEL_MARK_MIN 4096   /* Objects traced alone before waking the helpers */
+
+typedef struct
+{
+    GC_MarkStack stack;             /* Private to the worker */
+    GC_MarkStack shared;            /* Open to thieves, under `lock` */
+    int available;                  /* shared.count, for peeking without the lock */
+    pthread_mutex_t lock;
+} GC_MarkWorker;
+
+static GC_MarkWorker gc_mark_workers[GC_MAX_MARK_THREADS];
+static int gc_mark_nworkers = 1;      /* Workers including the evaluator thread */
+static int gc_mark_parallel = 0;      /* Set while the workers are marking */
+static int gc_mark_idle = 0;          /* Workers out of work */
+static unsigned int gc_mark_round = 0; /* Bumped to start the helpers */
+static int gc_mark_busy = 0;          /* Helpers still marking this round */
+static pthread_mutex_t gc_mark_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_mark_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gc_mark_done = PTHREAD_COND_INITIALIZER;
+
+/* Concurrent marking. With `concurrent_mark` set, a full cycle shades the
+ * roots in a short pause and leaves the tracing to a dedicated GC thread,
+ * which owns gc_gray while the evaluator keeps running. Objects allocated
+ * meanwhile are born black (mark bits are updated atomically on both
+ * threads), and references overwritten by the evaluator are shaded onto
+ * gc_satb, which is handed to the GC thread every GC_STEP_ALLOCS
+ * allocations. Once the GC thread has run out of work, a final remark
+ * pause stops it and traces what the last handoffs brought in.
+ *
+ * The GC thread only reads objects that existed when the cycle began.
+ * Arrays, cells and environments among those can still change, so the
+ * evaluator brackets such changes with gc_lock_object(), which takes one of
+ * GC_OBJECT_LOCKS striped mutexes, and the GC thread takes the same stripe
+ * while it reads the object's references. */
+#define GC_OBJECT_LOCKS 64
+
+static int gc_concurrent_thread = 0;   /* The GC thread was started */
+static int gc_concurrent_marking = 0;  /* The GC thread owns gc_gray */
+static int gc_concurrent_run = 0;      /* The GC thread should be tracing */
+static int gc_concurrent_stop = 0;     /* Asked to stop for the remark */
+static int gc_concurrent_idle = 0;     /* The GC thread ran out of work */
+static GC_MarkStack gc_satb;           /* Shaded by the evaluator, not yet handed over */
+static GC_MarkStack gc_satb_shared;    /* Handed over, under gc_concurrent_lock */
+static pthread_mutex_t gc_concurrent_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_concurrent_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gc_concurrent_stopped = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t gc_object_locks[GC_OBJECT_LOCKS];
+
+#if defined(__GNUC__)
+#define GC_PREFETCH(addr) __builtin_prefetch(addr)
+#define GC_HAVE_ATOMICS 1
+#define GC_ATOMIC_OR(ptr, value) __atomic_fetch_or(ptr, value, __ATOMIC_RELAXED)
+#define GC_ATOMIC_AND(ptr, value) __atomic_fetch_and(ptr, value, __ATOMIC_RELAXED)
+#define GC_ATOMIC_SWAP(ptr, value) __atomic_exchange_n(ptr, value, __ATOMIC_RELAXED)
+#define GC_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define GC_ATOMIC_STORE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST)
+#define GC_ATOMIC_ADD(ptr, value) __atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST)
+#else
+/* Without atomics marking stays on one thread (see gc_configure) */
+#define GC_PREFETCH(addr) ((void)0)
+#define GC_HAVE_ATOMICS 0
+#define GC_ATOMIC_OR(ptr, value) ((*(ptr) |= (value)) & ~(value))
+#define GC_ATOMIC_AND(ptr, value) (*(ptr) &= (value))
+#define GC_ATOMIC_SWAP(ptr, value) (*(ptr) = (value), 0)
+#define GC_ATOMIC_LOAD(ptr) (*(ptr))
+#define GC_ATOMIC_STORE(ptr, value) (*(ptr) = (value))
+#define GC_ATOMIC_ADD(ptr, value) (*(ptr) += (value))
+#endif
+
+static int gc_ctz64(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int n = 0;
+    while ((word & 1) == 0)
+    {
+        word >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static int gc_popcount64(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    int n = 0;
+    for (; word != 0; word &= word - 1)
+    {
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Bits of bitmap word `w` that correspond to real cells */
+static uint64_t gc_word_mask(int w)
+{
+    int cells = GC_BLOCK_CELLS - w * 64;
+    return cells >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << cells) - 1;
+}
+
+static GC_Block *gc_block_of(Object *obj)
+{
+    return (GC_Block *)((uintptr_t)obj & ~(uintptr_t)(GC_BLOCK_BYTES - 1));
+}
+
+/* Test, set or clear an object's bit in one of its block's bitmaps */
+#define GC_BITMAP(obj, map) (gc_block_of(obj)->map[((obj) - gc_block_of(obj)->cells) / 64])
+#define GC_BIT(obj) ((uint64_t)1 << (((obj) - gc_block_of(obj)->cells) % 64))
+#define GC_TEST(obj, map) ((GC_BITMAP(obj, map) & GC_BIT(obj)) != 0)
+#define GC_SET(obj, map) (GC_BITMAP(obj, map) |= GC_BIT(obj))
+#define GC_CLEAR(obj, map) (GC_BITMAP(obj, map) &= ~GC_BIT(obj))
+
+/* Slots of old objects that may reference young ones: an array element
+ * index, or 0 for a cell's value */
+typedef struct
+{
+    Object *owner;
+    int slot;
+} GC_RememberedSlot;
+
+static GC_RememberedSlot *gc_remembered = NULL;
+static int gc_remembered_count = 0;
+static int gc_remembered_capacity = 0;
+
+/* Interned strings, by open addressing on their hash. The table is weak:
+ * entries whose string died are dropped once marking finishes, the young
+ * ones after every minor collection and all of them after a full one. */
+typedef struct
+{
+    Object *string;
+    uint32_t hash;
+} GC_InternEntry;
+
+static GC_InternEntry *gc_interned = NULL;
+static int gc_interned_count = 0;
+static int gc_interned_capacity = 0; /* Power of two */
+static GC_InternEntry *gc_interned_young = NULL; /* Entries added since the last collection */
+static int gc_interned_young_count = 0;
+static int gc_interned_young_capacity = 0;
+
+/* Closure environments, split by generation like objects. They are marked
+ * by epoch rather than a reset flag, because root and frame environments get
+ * marked too but are never swept. */
+static Environment *gc_young_envs = NULL;
+static Environment *gc_old_envs = NULL;
+static unsigned int gc_epoch = 1;
+
+/* Payload size classes: 16, 32, ... bytes up to GC_PAYLOAD_MAX. Freed chunks
+ * are kept on a per-class list; new ones are carved from larger arenas. */
+#define GC_PAYLOAD_CLASSES 8
+#define GC_PAYLOAD_MAX (16 << (GC_PAYLOAD_CLASSES - 1))
+#define GC_PAYLOAD_ARENA_BYTES (64 * 1024)
+
+typedef struct GC_FreeChunk
+{
+    struct GC_FreeChunk *next;
+} GC_FreeChunk;
+
+static GC_FreeChunk *gc_payload_free[GC_PAYLOAD_CLASSES];
+static char *gc_payload_arena = NULL;
+static size_t gc_payload_arena_left = 0;
+
+/* Work of one sweep: what is left to sweep, and what it has freed and kept so
+ * far, until gc_sweep_publish() merges it into the heap. A full cycle's sweep
+ * may run on the sweeper thread, so it must not touch the globals above. */
+typedef struct
+{
+    GC_Block *pending;         /* Blocks still to sweep */
+    GC_Block *swept;           /* Swept blocks that still hold objects */
+    GC_Block *swept_tail;
+    Environment *envs_pending[2]; /* The old and young environments at the end of marking */
+    Environment *envs;         /* Surviving environments, now old */
+    Environment *envs_tail;
+    unsigned int epoch;        /* Mark epoch of surviving environments */
+    GC_FreeChunk *payload_free[GC_PAYLOAD_CLASSES];
+    GC_FreeChunk *payload_tail[GC_PAYLOAD_CLASSES];
+    size_t payload_freed;
+    size_t old_bytes;
+    int objects_freed;
+    int objects_promoted;
+    int envs_freed;
+} GC_Sweep;
+
+static GC_Sweep gc_sweep;                 /* The full cycle's sweep */
+static pthread_t gc_sweeper;
+static int gc_sweeper_running = 0;        /* gc_sweep belongs to the sweeper thread */
+static int gc_sweeper_done = 0;           /* Set by the sweeper when it finishes */
+
+/* Guards gc_free_blocks, gc_spare_blocks and gc_sweeper_done */
+static pthread_mutex_t gc_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Stack of temporary environments (for function calls, block scopes).
+ * Grows with call depth so deep recursion never leaves a live frame unrooted. */
+static Environment **gc_env_stack = NULL;
 static int gc_env_stack_top = 0;
+static int gc_env_stack_capacity = 0;
+
+/* Shadow stack of temporaries (see gc_root_scope) */
+static Object **gc_roots = NULL;
+static int gc_roots_count = 0;
+static int gc_roots_capacity = 0;
 
 /* Singleton objects that should never be freed */
 static Object *gc_singletons[3] = {NULL, NULL, NULL};
 
+/* Pause histogram in microseconds; the last bucket collects longer pauses */
+#define GC_PAUSE_BUCKETS 10000
+static int gc_pause_histogram[GC_PAUSE_BUCKETS];
+static double gc_pause_max_us = 0;
+static double gc_pause_total_us = 0;
+
+static void gc_collect_minor(void);
+
 void gc_init(void)
 {
-    gc_objects = NULL;
+    gc_free_blocks = NULL;
+    gc_young_blocks = NULL;
+    gc_alloc_block = NULL;
+    gc_sweep = (GC_Sweep){0};
     gc_num_objects = 0;
+    gc_young_bytes = 0;
+    gc_old_bytes = 0;
+    gc_payload_bytes = 0;
+    gc_live_bytes = 0;
     gc_alloc_count = 0;
-    gc_stats.objects_allocated = 0;
-    gc_stats.objects_freed = 0;
-    gc_stats.collections_run = 0;
+    gc_config_defaults(&gc_config);
+    gc_trigger_bytes = gc_config.min_heap_bytes;
+    gc_minor = 0;
+    gc_phase = GC_IDLE;
+    gc_stats = (GC_Stats){0};
     gc_global_env = NULL;
+    gc_gray.count = 0;
+    gc_gray.overflow = 0;
+    gc_remembered_count = 0;
+    gc_young_envs = NULL;
+    gc_old_envs = NULL;
+    gc_epoch = 1;
     gc_env_stack_top = 0;
+    gc_roots_count = 0;
+    free(gc_interned);
+    gc_interned = NULL;
+    gc_interned_count = 0;
+    gc_interned_capacity = 0;
+    gc_interned_young_count = 0;
+
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        gc_pause_histogram[i] = 0;
+    }
+    gc_pause_max_us = 0;
+    gc_pause_total_us = 0;
 }
 
 void gc_set_global_env(Environment *env)
@@ -37,10 +396,20 @@ void gc_set_global_env(Environment *env)
 
 void gc_push_env(Environment *env)
 {
-    if (gc_env_stack_top < MAX_ENV_STACK)
+    if (gc_env_stack_top == gc_env_stack_capacity)
     {
-        gc_env_stack[gc_env_stack_top++] = env;
+        int new_capacity = gc_env_stack_capacity < 64 ? 64 : gc_env_stack_capacity * 2;
+        Environment **new_stack = realloc(gc_env_stack, sizeof(*new_stack) * new_capacity);
+        if (new_stack == NULL)
+        {
+            fprintf(stderr, "GC: Failed to grow environment stack\n");
+            exit(1);
+        }
+        gc_env_stack = new_stack;
+        gc_env_stack_capacity = new_capacity;
     }
+
+    gc_env_stack[gc_env_stack_top++] = env;
 }
 
 void gc_pop_env(void)
@@ -51,6 +420,39 @@ void gc_pop_env(void)
     }
 }
 
+int gc_root_scope(void)
+{
+    return gc_roots_count;
+}
+
+void gc_push_root(Object *obj)
+{
+    if (gc_roots_count == gc_roots_capacity)
+    {
+        int new_capacity = gc_roots_capacity < 64 ? 64 : gc_roots_capacity * 2;
+        Object **new_roots = realloc(gc_roots, sizeof(*new_roots) * new_capacity);
+        if (new_roots == NULL)
+        {
+            fprintf(stderr, "GC: Failed to grow root stack\n");
+            exit(1);
+        }
+        gc_roots = new_roots;
+        gc_roots_capacity = new_capacity;
+    }
+
+    gc_roots[gc_roots_count++] = obj;
+}
+
+void gc_restore_roots(int scope)
+{
+    gc_roots_count = scope;
+}
+
+Object **gc_root_slots(int scope)
+{
+    return &gc_roots[scope];
+}
+
 /* Register singleton objects that should never be collected */
 void gc_register_singleton(Object *obj)
 {
@@ -59,7 +461,7 @@ void gc_register_singleton(Object *obj)
         return;
     }
 
-    obj->marked = 1; /* Always marked */
+    GC_SET(obj, marked); /* Always marked */
 
     /* Store in singletons array */
     for (int i = 0; i < 3; i++)
@@ -72,69 +474,222 @@ void gc_register_singleton(Object *obj)
     }
 }
 
-Object *gc_alloc_object(void)
+static double gc_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void gc_record_pause(double start_us)
 {
-    /* Trigger GC if threshold reached */
-    if (gc_alloc_count >= GC_THRESHOLD)
+    double pause = gc_now_us() - start_us;
+    int bucket = (int)pause;
+
+    if (bucket >= GC_PAUSE_BUCKETS)
     {
-        gc_collect();
-        gc_alloc_count = 0;
+        bucket = GC_PAUSE_BUCKETS - 1;
     }
+    gc_pause_histogram[bucket]++;
+    gc_pause_total_us += pause;
 
-    Object *obj = malloc(sizeof(Object));
-    if (obj == NULL)
+    if (pause > gc_pause_max_us)
     {
-        fprintf(stderr, "GC: Failed to allocate object\n");
-        exit(1);
+        gc_pause_max_us = pause;
     }
+    gc_stats.pauses++;
+}
 
-    obj->marked = 0;
-    obj->gc_next = gc_objects;
-    gc_objects = obj;
+static pthread_mutex_t *gc_object_lock(const void *ptr)
+{
+    return &gc_object_locks[((uintptr_t)ptr >> 5) % GC_OBJECT_LOCKS];
+}
 
-    gc_num_objects++;
-    gc_alloc_count++;
-    gc_stats.objects_allocated++;
+void gc_lock_object(const void *ptr)
+{
+    if (gc_concurrent_marking)
+    {
+        pthread_mutex_lock(gc_object_lock(ptr));
+    }
+}
 
-    return obj;
+void gc_unlock_object(const void *ptr)
+{
+    if (gc_concurrent_marking)
+    {
+        pthread_mutex_unlock(gc_object_lock(ptr));
+    }
 }
 
-void gc_mark_object(Object *obj)
+/* Set an object's mark bit. Returns 0 if it was marked already, or is old
+ * during a minor collection, which takes every old object as live. */
+static int gc_try_mark(Object *obj)
+{
+    GC_Block *block = gc_block_of(obj);
+    int index = (int)(obj - block->cells);
+    uint64_t bit = (uint64_t)1 << (index % 64);
+
+    if (gc_minor && (block->old[index / 64] & bit))
+    {
+        return 0;
+    }
+    if (gc_mark_parallel)
+    {
+        return (GC_ATOMIC_OR(&block->marked[index / 64], bit) & bit) == 0;
+    }
+    if (block->marked[index / 64] & bit)
+    {
+        return 0;
+    }
+    block->marked[index / 64] |= bit;
+    return 1;
+}
+
+static void gc_push_gray(GC_MarkStack *stack, Object *obj)
 {
-    if (obj == NULL || obj->marked)
+    if (obj == NULL)
     {
         return;
     }
 
-    obj->marked = 1;
+    if (stack->count == stack->capacity)
+    {
+        int new_capacity = stack->capacity < 256 ? 256 : stack->capacity * 2;
+        Object **new_items = realloc(stack->items, sizeof(*new_items) * new_capacity);
+        if (new_items == NULL)
+        {
+            /* Out of memory for the stack: mark now, trace on a later rescan */
+            if (gc_try_mark(obj))
+            {
+                stack->overflow = 1;
+            }
+            return;
+        }
+        stack->items = new_items;
+        stack->capacity = new_capacity;
+    }
+
+    GC_PREFETCH(obj);
+    stack->items[stack->count++] = obj;
+}
 
-    /* Mark nested objects based on type */
-    switch (obj->type)
+/* Shade an object gray: mark it and queue its references for scanning */
+void gc_mark_object(Object *obj)
+{
+    gc_push_gray(gc_concurrent_marking ? &gc_satb : &gc_gray, obj);
+}
+
+/* Claim an environment for tracing this epoch */
+static int gc_claim_env(Environment *env)
+{
+    if (gc_mark_parallel)
     {
-    case OBJECT_RETURN_VALUE:
-        gc_mark_object(obj->value.return_value);
-        break;
+        return GC_ATOMIC_SWAP(&env->mark_epoch, gc_epoch) != gc_epoch;
+    }
+    if (env->mark_epoch == gc_epoch)
+    {
+        return 0;
+    }
+    env->mark_epoch = gc_epoch;
+    return 1;
+}
+
+static void gc_push_env_gray(GC_MarkStack *stack, Environment *env)
+{
+    /* Walk the outer chain iteratively, stopping at the first environment
+     * already traced this cycle: its whole chain is marked already. */
+    while (env != NULL && gc_claim_env(env))
+    {
+        gc_lock_object(env);
+        for (int i = 0; i < env->count; i++)
+        {
+            gc_push_gray(stack, env->bindings[i].value);
+        }
+        gc_unlock_object(env);
+
+        env = env->outer;
+    }
+}
+
+void gc_mark_env(Environment *env)
+{
+    gc_push_env_gray(gc_concurrent_marking ? &gc_satb : &gc_gray, env);
+}
 
+/* Blacken an object by shading whatever it references */
+static void gc_mark_children(GC_MarkStack *stack, Object *obj)
+{
+    switch (obj->type)
+    {
     case OBJECT_FUNCTION:
         /* Mark function's closure environment */
-        if (obj->value.function.env != NULL)
+        if (obj->value.function != NULL && obj->value.function->env != NULL)
         {
-            gc_mark_env(obj->value.function.env);
+            gc_push_env_gray(stack, obj->value.function->env);
         }
         break;
 
     case OBJECT_ARRAY:
-        /* Mark all elements in the array */
-        for (int i = 0; i < obj->value.array.length; i++)
+        /* Mark all elements in the array; unboxed integers reference nothing */
+        gc_lock_object(obj);
+        if (obj->value.array != NULL && !(obj->flags & OBJECT_ARRAY_INTS))
+        {
+            ArrayStorage *storage = obj->value.array;
+            for (int i = 0; i < storage->length; i++)
+            {
+                gc_push_gray(stack, storage->elements[i]);
+            }
+        }
+        gc_unlock_object(obj);
+        break;
+
+    case OBJECT_HASH:
+        /* Mark every value and string key; other keys are kept by value */
+        gc_lock_object(obj);
+        if (obj->value.hash != NULL)
+        {
+            HashTable *table = obj->value.hash;
+            for (int i = 0; i < table->capacity; i++)
+            {
+                HashEntry *entry = &table->entries[i];
+                if (entry->value != NULL)
+                {
+                    if (entry->key_type == OBJECT_STRING)
+                    {
+                        gc_push_gray(stack, entry->key.string);
+                    }
+                    gc_push_gray(stack, entry->value);
+                }
+            }
+        }
+        gc_unlock_object(obj);
+        break;
+
+    case OBJECT_CELL:
+        gc_lock_object(obj);
+        gc_push_gray(stack, obj->value.cell);
+        gc_unlock_object(obj);
+        break;
+
+    case OBJECT_STRING:
+        /* A rope references its operands until it is flattened, and a view
+         * its parent */
+        gc_lock_object(obj);
+        if (obj->flags & OBJECT_STRING_ROPE)
         {
-            gc_mark_object(obj->value.array.elements[i]);
+            gc_push_gray(stack, obj->value.rope->left);
+            gc_push_gray(stack, obj->value.rope->right);
         }
+        else if (obj->flags & OBJECT_STRING_VIEW)
+        {
+            gc_push_gray(stack, obj->value.view->parent);
+        }
+        gc_unlock_object(obj);
         break;
 
     case OBJECT_INTEGER:
     case OBJECT_BOOLEAN:
     case OBJECT_NULL:
-    case OBJECT_STRING:
     case OBJECT_BUILTIN:
     case OBJECT_ERROR:
         /* These types don't contain object references */
@@ -142,117 +697,1592 @@ void gc_mark_object(Object *obj)
     }
 }
 
-void gc_mark_env(Environment *env)
+/* Trace the children of every marked object again after the mark stack
+ * overflowed. Tracing an object twice is harmless. */
+static void gc_rescan_marked(void)
 {
-    if (env == NULL)
-    {
-        return;
-    }
+    gc_gray.overflow = 0;
 
-    /* Mark all values in this environment */
-    Environment_Binding *binding = env->bindings;
-    while (binding != NULL)
+    for (GC_Block *block = gc_blocks; block != NULL; block = block->next)
     {
-        gc_mark_object(binding->value);
-        binding = binding->next;
+        for (int w = 0; w < GC_BLOCK_WORDS; w++)
+        {
+            uint64_t bits = block->in_use[w] & block->marked[w];
+            if (gc_minor)
+            {
+                bits &= ~block->old[w];
+            }
+
+            for (; bits != 0; bits &= bits - 1)
+            {
+                gc_mark_children(&gc_gray, &block->cells[w * 64 + gc_ctz64(bits)]);
+            }
+        }
     }
+}
 
-    /* Recursively mark outer environment */
-    if (env->outer != NULL)
+/* Pop up to `budget` objects off the mark stack, tracing the ones not yet
+ * marked. Returns 1 once there is nothing left to trace. */
+static int gc_drain_gray(int budget)
+{
+    while (budget-- > 0)
     {
-        gc_mark_env(env->outer);
+        if (gc_gray.count == 0)
+        {
+            if (!gc_gray.overflow)
+            {
+                return 1;
+            }
+            gc_rescan_marked();
+            continue;
+        }
+
+        Object *obj = gc_gray.items[--gc_gray.count];
+        if (gc_try_mark(obj))
+        {
+            gc_mark_children(&gc_gray, obj);
+        }
     }
+    return gc_gray.count == 0 && !gc_gray.overflow;
 }
 
-static void gc_mark_roots(void)
+/* Move `count` objects from the top of one mark stack onto another */
+static void gc_move_gray(GC_MarkStack *from, GC_MarkStack *to, int count)
 {
-    /* Mark global environment */
-    if (gc_global_env != NULL)
+    for (int i = from->count - count; i < from->count; i++)
     {
-        gc_mark_env(gc_global_env);
+        gc_push_gray(to, from->items[i]);
     }
+    from->count -= count;
+}
 
-    /* Mark all environments in the stack */
-    for (int i = 0; i < gc_env_stack_top; i++)
+/* Offer half of a worker's private stack to thieves */
+static void gc_share_work(GC_MarkWorker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    gc_move_gray(&worker->stack, &worker->shared, worker->stack.count / 2);
+    GC_ATOMIC_STORE(&worker->available, worker->shared.count);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/* Take half of some worker's shared queue, trying our own first */
+static int gc_steal_work(int self)
+{
+    GC_MarkWorker *worker = &gc_mark_workers[self];
+
+    for (int i = 0; i < gc_mark_nworkers; i++)
     {
-        if (gc_env_stack[i] != NULL)
+        GC_MarkWorker *victim = &gc_mark_workers[(self + i) % gc_mark_nworkers];
+        if (GC_ATOMIC_LOAD(&victim->available) == 0)
         {
-            gc_mark_env(gc_env_stack[i]);
+            continue;
         }
-    }
 
-    /* Mark singletons */
-    for (int i = 0; i < 3; i++)
-    {
-        if (gc_singletons[i] != NULL)
+        pthread_mutex_lock(&victim->lock);
+        int count = (victim->shared.count + 1) / 2;
+        gc_move_gray(&victim->shared, &worker->stack, count);
+        GC_ATOMIC_STORE(&victim->available, victim->shared.count);
+        pthread_mutex_unlock(&victim->lock);
+
+        if (count > 0)
         {
-            gc_singletons[i]->marked = 1;
+            return 1;
         }
     }
+    return 0;
 }
 
-static void gc_sweep(void)
+/* Wait for work to steal or for every worker to run out. Returns 1 once
+ * marking is over. */
+static int gc_mark_terminate(void)
 {
-    Object **obj_ptr = &gc_objects;
+    GC_ATOMIC_ADD(&gc_mark_idle, 1);
 
-    while (*obj_ptr != NULL)
+    for (;;)
     {
-        Object *obj = *obj_ptr;
-
-        if (!obj->marked)
+        if (GC_ATOMIC_LOAD(&gc_mark_idle) == gc_mark_nworkers)
         {
-            /* Unlink from list */
-            *obj_ptr = obj->gc_next;
-
-            /* Free object-specific memory */
-            if (obj->type == OBJECT_STRING && obj->value.string.owned && obj->value.string.data != NULL)
+            return 1;
+        }
+        for (int i = 0; i < gc_mark_nworkers; i++)
+        {
+            if (GC_ATOMIC_LOAD(&gc_mark_workers[i].available) > 0)
             {
-                free(obj->value.string.data);
+                GC_ATOMIC_ADD(&gc_mark_idle, -1);
+                return 0;
             }
-            else if (obj->type == OBJECT_ERROR && obj->value.error != NULL)
+        }
+        sched_yield();
+    }
+}
+
+/* One worker's share of a parallel mark */
+static void gc_mark_work(int self)
+{
+    GC_MarkWorker *worker = &gc_mark_workers[self];
+
+    for (;;)
+    {
+        while (worker->stack.count > 0)
+        {
+            Object *obj = worker->stack.items[--worker->stack.count];
+            if (!gc_try_mark(obj))
             {
-                free(obj->value.error);
+                continue;
             }
-            else if (obj->type == OBJECT_ARRAY && obj->value.array.elements != NULL)
+            gc_mark_children(&worker->stack, obj);
+
+            if (worker->stack.count > GC_MARK_SHARE_MIN &&
+                GC_ATOMIC_LOAD(&worker->available) == 0)
             {
-                free(obj->value.array.elements);
+                gc_share_work(worker);
             }
-
-            /* Free the object itself */
-            free(obj);
-            gc_num_objects--;
-            gc_stats.objects_freed++;
         }
-        else
+
+        if (!gc_steal_work(self) && gc_mark_terminate())
         {
-            /* Reset mark for next collection */
-            obj->marked = 0;
-            obj_ptr = &obj->gc_next;
+            return;
         }
     }
 }
 
-void gc_collect(void)
+static void *gc_mark_helper_main(void *arg)
 {
-#ifdef GC_DEBUG
-    int before = gc_num_objects;
-#endif
+    int self = (int)(intptr_t)arg;
+    unsigned int seen = 0;
 
-    /* Mark phase */
-    gc_mark_roots();
+    pthread_mutex_lock(&gc_mark_lock);
+    for (;;)
+    {
+        while (gc_mark_round == seen)
+        {
+            pthread_cond_wait(&gc_mark_start, &gc_mark_lock);
+        }
+        seen = gc_mark_round;
+        pthread_mutex_unlock(&gc_mark_lock);
 
-    /* Sweep phase */
-    gc_sweep();
+        gc_mark_work(self);
 
-    gc_stats.collections_run++;
+        pthread_mutex_lock(&gc_mark_lock);
+        if (--gc_mark_busy == 0)
+        {
+            pthread_cond_signal(&gc_mark_done);
+        }
+    }
+    return NULL;
+}
 
-#ifdef GC_DEBUG
-    printf("GC: Collected %d objects (%d remaining)\n",
-           before - gc_num_objects, gc_num_objects);
-#endif
+/* Start the helper threads for `threads`-way marking; keeps however many
+ * could be started */
+static void gc_start_mark_helpers(int threads)
+{
+    if (!GC_HAVE_ATOMICS)
+    {
+        threads = 1;
+    }
+
+    for (int i = gc_mark_nworkers; i < threads; i++)
+    {
+        pthread_t thread;
+        pthread_mutex_init(&gc_mark_workers[i].lock, NULL);
+        if (pthread_create(&thread, NULL, gc_mark_helper_main, (void *)(intptr_t)i) != 0)
+        {
+            break;
+        }
+        pthread_detach(thread);
+        gc_mark_nworkers = i + 1;
+    }
 }
 
-GC_Stats gc_get_stats(void)
+/* Trace everything reachable from the gray objects before returning. Past
+ * a first stretch on this thread, the rest is marked in parallel. */
+static void gc_drain_all(void)
 {
-    return gc_stats;
+    if (gc_mark_nworkers == 1 || gc_drain_gray(GC_PARALLEL_MARK_MIN))
+    {
+        gc_drain_gray(INT_MAX);
+        return;
+    }
+
+    /* Deal the gray objects out across the workers */
+    for (int i = 0; i < gc_gray.count; i++)
+    {
+        gc_push_gray(&gc_mark_workers[i % gc_mark_nworkers].stack, gc_gray.items[i]);
+    }
+    gc_gray.count = 0;
+
+    gc_mark_parallel = 1;
+    gc_mark_idle = 0;
+
+    pthread_mutex_lock(&gc_mark_lock);
+    gc_mark_busy = gc_mark_nworkers - 1;
+    gc_mark_round++;
+    pthread_cond_broadcast(&gc_mark_start);
+    pthread_mutex_unlock(&gc_mark_lock);
+
+    gc_mark_work(0);
+
+    pthread_mutex_lock(&gc_mark_lock);
+    while (gc_mark_busy > 0)
+    {
+        pthread_cond_wait(&gc_mark_done, &gc_mark_lock);
+    }
+    pthread_mutex_unlock(&gc_mark_lock);
+
+    gc_mark_parallel = 0;
+
+    /* Objects a worker could not queue are found by the usual rescan */
+    for (int i = 0; i < gc_mark_nworkers; i++)
+    {
+        if (gc_mark_workers[i].stack.overflow || gc_mark_workers[i].shared.overflow)
+        {
+            gc_gray.overflow = 1;
+        }
+        gc_mark_workers[i].stack.overflow = 0;
+        gc_mark_workers[i].shared.overflow = 0;
+    }
+    gc_drain_gray(INT_MAX);
+}
+
+static void *gc_concurrent_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&gc_concurrent_lock);
+    for (;;)
+    {
+        if (!gc_concurrent_run)
+        {
+            pthread_cond_wait(&gc_concurrent_wake, &gc_concurrent_lock);
+            continue;
+        }
+        if (gc_concurrent_stop)
+        {
+            gc_concurrent_run = 0;
+            gc_concurrent_stop = 0;
+            gc_concurrent_idle = 0;
+            pthread_cond_signal(&gc_concurrent_stopped);
+            continue;
+        }
+
+        gc_move_gray(&gc_satb_shared, &gc_gray, gc_satb_shared.count);
+        if (gc_gray.count == 0)
+        {
+            gc_concurrent_idle = 1;
+            pthread_cond_wait(&gc_concurrent_wake, &gc_concurrent_lock);
+            continue;
+        }
+        gc_concurrent_idle = 0;
+        pthread_mutex_unlock(&gc_concurrent_lock);
+
+        /* Trace a slice, then look for a stop request or new work. Marked
+         * objects that could not be queued wait for the remark's rescan,
+         * which needs the heap to hold still. */
+        for (int budget = GC_MARK_BUDGET; budget > 0 && gc_gray.count > 0; budget--)
+        {
+            Object *obj = gc_gray.items[--gc_gray.count];
+            if (gc_try_mark(obj))
+            {
+                gc_mark_children(&gc_gray, obj);
+            }
+        }
+
+        pthread_mutex_lock(&gc_concurrent_lock);
+    }
+    return NULL;
+}
+
+/* Start the GC thread for concurrent marking. Returns 0 if it cannot be
+ * started, leaving marking incremental. */
+static int gc_start_concurrent_thread(void)
+{
+    pthread_t thread;
+
+    if (!GC_HAVE_ATOMICS)
+    {
+        return 0;
+    }
+    for (int i = 0; i < GC_OBJECT_LOCKS; i++)
+    {
+        pthread_mutex_init(&gc_object_locks[i], NULL);
+    }
+    if (pthread_create(&thread, NULL, gc_concurrent_main, NULL) != 0)
+    {
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
+
+/* Hand the shaded roots over to the GC thread */
+static void gc_start_concurrent_mark(void)
+{
+    gc_mark_parallel = 1;
+    gc_concurrent_marking = 1;
+
+    pthread_mutex_lock(&gc_concurrent_lock);
+    gc_concurrent_run = 1;
+    gc_concurrent_idle = 0;
+    pthread_cond_signal(&gc_concurrent_wake);
+    pthread_mutex_unlock(&gc_concurrent_lock);
+}
+
+/* Pass the evaluator's shaded references to the GC thread. Returns 1 once
+ * the GC thread has traced everything handed to it before: the references
+ * shaded since then are left for the remark, or overwrites would keep the
+ * GC thread busy forever. */
+static int gc_concurrent_step(void)
+{
+    pthread_mutex_lock(&gc_concurrent_lock);
+    int done = gc_concurrent_idle && gc_satb_shared.count == 0;
+    if (!done && gc_satb.count > 0)
+    {
+        gc_move_gray(&gc_satb, &gc_satb_shared, gc_satb.count);
+        pthread_cond_signal(&gc_concurrent_wake);
+    }
+    pthread_mutex_unlock(&gc_concurrent_lock);
+    return done;
+}
+
+/* Stop the GC thread and take its remaining work back onto gc_gray, for the
+ * evaluator to finish in the remark pause */
+static void gc_stop_concurrent_mark(void)
+{
+    pthread_mutex_lock(&gc_concurrent_lock);
+    gc_concurrent_stop = 1;
+    pthread_cond_signal(&gc_concurrent_wake);
+    while (gc_concurrent_run)
+    {
+        pthread_cond_wait(&gc_concurrent_stopped, &gc_concurrent_lock);
+    }
+    pthread_mutex_unlock(&gc_concurrent_lock);
+
+    gc_concurrent_marking = 0;
+    gc_mark_parallel = 0;
+
+    gc_move_gray(&gc_satb_shared, &gc_gray, gc_satb_shared.count);
+    gc_move_gray(&gc_satb, &gc_gray, gc_satb.count);
+    if (gc_satb.overflow || gc_satb_shared.overflow)
+    {
+        gc_gray.overflow = 1;
+    }
+    gc_satb.overflow = 0;
+    gc_satb_shared.overflow = 0;
+}
+
+static void gc_mark_roots(void)
+{
+    /* Mark global environment */
+    if (gc_global_env != NULL)
+    {
+        gc_mark_env(gc_global_env);
+    }
+
+    /* Mark all environments in the stack */
+    for (int i = 0; i < gc_env_stack_top; i++)
+    {
+        if (gc_env_stack[i] != NULL)
+        {
+            gc_mark_env(gc_env_stack[i]);
+        }
+    }
+
+    /* Mark temporaries on the shadow stack */
+    for (int i = 0; i < gc_roots_count; i++)
+    {
+        gc_mark_object(gc_roots[i]);
+    }
+
+    /* Mark singletons */
+    for (int i = 0; i < 3; i++)
+    {
+        gc_mark_object(gc_singletons[i]);
+    }
+}
+
+void gc_write_barrier(Object *owner, int slot, Object *old_value, Object *new_value)
+{
+    /* Snapshot barrier: the overwritten reference may be the marker's only
+     * path to an object that was reachable when the cycle began */
+    if (gc_phase == GC_MARKING)
+    {
+        gc_mark_object(old_value);
+    }
+
+    if (owner == NULL || new_value == NULL)
+    {
+        return;
+    }
+
+    /* An object in a block still waiting to be swept was live when marking
+     * finished, so the sweep will make it old. Its bitmaps may be changing
+     * under the sweeper thread, so it is judged by its block alone. */
+    if (gc_block_of(new_value)->unswept || GC_TEST(new_value, old))
+    {
+        return;
+    }
+    if (!gc_block_of(owner)->unswept && !GC_TEST(owner, old))
+    {
+        return;
+    }
+
+    if (gc_remembered_count == gc_remembered_capacity)
+    {
+        int new_capacity = gc_remembered_capacity < 64 ? 64 : gc_remembered_capacity * 2;
+        GC_RememberedSlot *new_set = realloc(gc_remembered, sizeof(*new_set) * new_capacity);
+        if (new_set == NULL)
+        {
+            fprintf(stderr, "GC: Failed to grow remembered set\n");
+            exit(1);
+        }
+        gc_remembered = new_set;
+        gc_remembered_capacity = new_capacity;
+    }
+
+    gc_remembered[gc_remembered_count].owner = owner;
+    gc_remembered[gc_remembered_count].slot = slot;
+    gc_remembered_count++;
+}
+
+void gc_config_defaults(GC_Config *config)
+{
+    config->nursery_bytes = GC_NURSERY_BYTES;
+    config->growth_factor = GC_GROWTH_FACTOR;
+    config->min_heap_bytes = GC_MIN_HEAP_BYTES;
+    config->soft_limit_bytes = 0;
+    config->background_sweep = 0;
+    config->mark_threads = 1;
+    config->concurrent_mark = 0;
+}
+
+/* Parse a byte count with an optional k/m/g suffix */
+static int gc_parse_bytes(const char *text, size_t *out)
+{
+    char *end;
+    double value = strtod(text, &end);
+
+    if (end == text || value < 0)
+    {
+        return 0;
+    }
+
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        value *= 1024;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        value *= 1024 * 1024;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        value *= 1024.0 * 1024 * 1024;
+        end++;
+        break;
+    }
+
+    if (*end != '\0')
+    {
+        return 0;
+    }
+
+    *out = (size_t)value;
+    return 1;
+}
+
+/* Parse an on/off setting: "0" or "1" */
+static int gc_parse_switch(const char *text, int *out)
+{
+    if (strcmp(text, "0") != 0 && strcmp(text, "1") != 0)
+    {
+        return 0;
+    }
+    *out = text[0] == '1';
+    return 1;
+}
+
+int gc_config_set(GC_Config *config, const char *name, const char *value)
+{
+    if (strcmp(name, "nursery") == 0)
+    {
+        return gc_parse_bytes(value, &config->nursery_bytes) && config->nursery_bytes > 0;
+    }
+    if (strcmp(name, "min-heap") == 0)
+    {
+        return gc_parse_bytes(value, &config->min_heap_bytes);
+    }
+    if (strcmp(name, "soft-limit") == 0)
+    {
+        return gc_parse_bytes(value, &config->soft_limit_bytes);
+    }
+    if (strcmp(name, "background-sweep") == 0)
+    {
+        return gc_parse_switch(value, &config->background_sweep);
+    }
+    if (strcmp(name, "concurrent-mark") == 0)
+    {
+        return gc_parse_switch(value, &config->concurrent_mark);
+    }
+    if (strcmp(name, "mark-threads") == 0)
+    {
+        char *end;
+        long threads = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || threads < 1 || threads > GC_MAX_MARK_THREADS)
+        {
+            return 0;
+        }
+        config->mark_threads = (int)threads;
+        return 1;
+    }
+    if (strcmp(name, "growth") == 0)
+    {
+        char *end;
+        double factor = strtod(value, &end);
+        if (end == value || *end != '\0' || factor <= 1.0)
+        {
+            return 0;
+        }
+        config->growth_factor = factor;
+        return 1;
+    }
+    return 0;
+}
+
+int gc_config_from_env(GC_Config *config)
+{
+    static const char *const names[][2] = {
+        {"PASATHAI_GC_NURSERY", "nursery"},
+        {"PASATHAI_GC_GROWTH", "growth"},
+        {"PASATHAI_GC_MIN_HEAP", "min-heap"},
+        {"PASATHAI_GC_SOFT_LIMIT", "soft-limit"},
+        {"PASATHAI_GC_BACKGROUND_SWEEP", "background-sweep"},
+        {"PASATHAI_GC_MARK_THREADS", "mark-threads"},
+        {"PASATHAI_GC_CONCURRENT_MARK", "concurrent-mark"},
+    };
+
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+    {
+        const char *value = getenv(names[i][0]);
+        if (value != NULL && !gc_config_set(config, names[i][1], value))
+        {
+            fprintf(stderr, "GC: Invalid value for %s: '%s'\n", names[i][0], value);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Pick the old-generation size at which the next full cycle starts */
+static void gc_schedule_full(void)
+{
+    size_t trigger = (size_t)(gc_live_bytes * gc_config.growth_factor);
+    size_t limit = gc_config.soft_limit_bytes;
+
+    if (trigger < gc_config.min_heap_bytes)
+    {
+        trigger = gc_config.min_heap_bytes;
+    }
+
+    /* Near the soft limit, allow only half of the remaining room; past it,
+     * start the next cycle as soon as one nursery has been promoted */
+    if (limit > 0)
+    {
+        size_t cap = limit > gc_live_bytes ? gc_live_bytes + (limit - gc_live_bytes) / 2 : 0;
+        if (cap < gc_live_bytes + gc_config.nursery_bytes)
+        {
+            cap = gc_live_bytes + gc_config.nursery_bytes;
+        }
+        if (trigger > cap)
+        {
+            trigger = cap;
+        }
+    }
+
+    gc_trigger_bytes = trigger;
+}
+
+void gc_configure(const GC_Config *config)
+{
+    gc_config = *config;
+    gc_start_mark_helpers(config->mark_threads);
+    if (config->concurrent_mark && !gc_concurrent_thread)
+    {
+        gc_concurrent_thread = gc_start_concurrent_thread();
+    }
+    gc_schedule_full();
+}
+
+static size_t gc_env_size(Environment *env)
+{
+    return sizeof(Environment) + env->capacity * sizeof(Environment_Binding);
+}
+
+static int gc_payload_class(size_t size)
+{
+    int cls = 0;
+
+    if (size > GC_PAYLOAD_MAX)
+    {
+        return -1;
+    }
+    while ((size_t)(16 << cls) < size)
+    {
+        cls++;
+    }
+    return cls;
+}
+
+void *gc_alloc_payload(size_t size)
+{
+    int cls = gc_payload_class(size);
+    void *chunk;
+
+    gc_payload_bytes += size;
+    gc_young_bytes += size;
+
+    if (cls < 0)
+    {
+        chunk = malloc(size);
+    }
+    else if (gc_payload_free[cls] != NULL)
+    {
+        chunk = gc_payload_free[cls];
+        gc_payload_free[cls] = gc_payload_free[cls]->next;
+    }
+    else
+    {
+        size_t chunk_size = (size_t)16 << cls;
+        if (gc_payload_arena_left < chunk_size)
+        {
+            /* The tail of the old arena is too small for this class; it is
+             * simply left unused */
+            gc_payload_arena = malloc(GC_PAYLOAD_ARENA_BYTES);
+            gc_payload_arena_left = gc_payload_arena != NULL ? GC_PAYLOAD_ARENA_BYTES : 0;
+        }
+        chunk = gc_payload_arena;
+        if (chunk != NULL)
+        {
+            gc_payload_arena += chunk_size;
+            gc_payload_arena_left -= chunk_size;
+        }
+    }
+
+    if (chunk == NULL)
+    {
+        fprintf(stderr, "GC: Failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return chunk;
+}
+
+void gc_free_payload(void *payload, size_t size)
+{
+    int cls = gc_payload_class(size);
+
+    if (payload == NULL)
+    {
+        return;
+    }
+    gc_payload_bytes -= size;
+    if (cls < 0)
+    {
+        free(payload);
+        return;
+    }
+
+    GC_FreeChunk *chunk = payload;
+    chunk->next = gc_payload_free[cls];
+    gc_payload_free[cls] = chunk;
+}
+
+void *gc_realloc_payload(void *payload, size_t old_size, size_t new_size)
+{
+    if (payload != NULL && gc_payload_class(old_size) >= 0 &&
+        gc_payload_class(old_size) == gc_payload_class(new_size))
+    {
+        /* Growth counts toward the nursery budget like a fresh allocation */
+        gc_payload_bytes += new_size - old_size;
+        if (new_size > old_size)
+        {
+            gc_young_bytes += new_size - old_size;
+        }
+        return payload;
+    }
+
+    void *resized = gc_alloc_payload(new_size);
+    if (payload != NULL)
+    {
+        memcpy(resized, payload, old_size < new_size ? old_size : new_size);
+        gc_free_payload(payload, old_size);
+    }
+    return resized;
+}
+
+/* Keep a dead object's payload chunk for gc_sweep_publish(). Large payloads
+ * came straight from malloc() and go straight back. */
+static void gc_sweep_free_payload(GC_Sweep *sweep, void *payload, size_t size)
+{
+    int cls = gc_payload_class(size);
+
+    sweep->payload_freed += size;
+    if (cls < 0)
+    {
+        free(payload);
+        return;
+    }
+
+    GC_FreeChunk *chunk = payload;
+    if (sweep->payload_free[cls] == NULL)
+    {
+        sweep->payload_tail[cls] = chunk;
+    }
+    chunk->next = sweep->payload_free[cls];
+    sweep->payload_free[cls] = chunk;
+}
+
+/* Release a dead object's payload; its cell is freed by clearing its in-use bit */
+static void gc_free_object(GC_Sweep *sweep, Object *obj)
+{
+    /* Free object-specific memory. Small strings live in the cell itself and
+     * borrowed ones in the AST, so neither has anything to free. */
+    if (obj->type == OBJECT_STRING && (obj->flags & OBJECT_STRING_ROPE))
+    {
+        gc_sweep_free_payload(sweep, obj->value.rope, sizeof(Rope));
+    }
+    else if (obj->type == OBJECT_STRING && (obj->flags & OBJECT_STRING_VIEW))
+    {
+        gc_sweep_free_payload(sweep, obj->value.view, sizeof(StringView));
+    }
+    else if (obj->type == OBJECT_STRING && (obj->flags & OBJECT_STRING_OWNED) && obj->value.string != NULL)
+    {
+        String *string = obj->value.string;
+        if (string->crumbs != NULL)
+        {
+            gc_sweep_free_payload(sweep, string->crumbs, STRING_CRUMBS_BYTES(string->chars));
+        }
+        gc_sweep_free_payload(sweep, string, STRING_BYTES(string->length));
+    }
+    else if (obj->type == OBJECT_ERROR && obj->value.error != NULL)
+    {
+        free(obj->value.error);
+    }
+    else if (obj->type == OBJECT_ARRAY && obj->value.array != NULL)
+    {
+        gc_sweep_free_payload(sweep, obj->value.array, ARRAY_BYTES(obj));
+    }
+    else if (obj->type == OBJECT_HASH && obj->value.hash != NULL)
+    {
+        gc_sweep_free_payload(sweep, obj->value.hash, HASH_TABLE_BYTES(obj->value.hash->capacity));
+    }
+    else if (obj->type == OBJECT_FUNCTION && obj->value.function != NULL)
+    {
+        gc_sweep_free_payload(sweep, obj->value.function, sizeof(Closure));
+    }
+
+    sweep->objects_freed++;
+}
+
+/* Free the dead objects in a block and promote the survivors in place, one
+ * bitmap word at a time. A minor sweep (`minor` set) leaves old objects alone. */
+static void gc_sweep_block(GC_Sweep *sweep, GC_Block *block, int minor)
+{
+    int survivors = 0;
+
+    for (int w = 0; w < GC_BLOCK_WORDS; w++)
+    {
+        uint64_t in_use = block->in_use[w];
+        uint64_t dead = in_use & ~block->marked[w];
+        uint64_t promoted = in_use & block->marked[w] & ~block->old[w];
+
+        if (minor)
+        {
+            dead &= ~block->old[w];
+        }
+
+        for (uint64_t bits = dead; bits != 0; bits &= bits - 1)
+        {
+            gc_free_object(sweep, &block->cells[w * 64 + gc_ctz64(bits)]);
+        }
+
+        block->in_use[w] = in_use & ~dead;
+        block->old[w] |= promoted;
+        block->marked[w] = 0;
+        block->live -= gc_popcount64(dead);
+
+        sweep->objects_promoted += gc_popcount64(promoted);
+        survivors += gc_popcount64(minor ? promoted : block->in_use[w]);
+    }
+
+    sweep->old_bytes += survivors * sizeof(Object);
+    block->alloc_cursor = 0;
+}
+
+/* Offer a block's free cells to the allocator */
+static void gc_release_block(GC_Block *block)
+{
+    pthread_mutex_lock(&gc_heap_lock);
+    if (block->live < GC_BLOCK_CELLS && !block->on_free_list)
+    {
+        block->on_free_list = 1;
+        block->next_free = gc_free_blocks;
+        gc_free_blocks = block;
+    }
+    pthread_mutex_unlock(&gc_heap_lock);
+}
+
+/* Free an environment not marked this epoch, or keep it as old */
+static void gc_sweep_env(GC_Sweep *sweep, Environment *env)
+{
+    if (env->mark_epoch != sweep->epoch)
+    {
+        free(env->bindings);
+        free(env);
+        sweep->envs_freed++;
+        return;
+    }
+
+    if (sweep->envs == NULL)
+    {
+        sweep->envs_tail = env;
+    }
+    env->gc_next = sweep->envs;
+    sweep->envs = env;
+    sweep->old_bytes += gc_env_size(env);
+}
+
+/* Merge what a sweep has freed and kept so far into the heap */
+static void gc_sweep_publish(GC_Sweep *sweep)
+{
+    for (int cls = 0; cls < GC_PAYLOAD_CLASSES; cls++)
+    {
+        if (sweep->payload_free[cls] != NULL)
+        {
+            sweep->payload_tail[cls]->next = gc_payload_free[cls];
+            gc_payload_free[cls] = sweep->payload_free[cls];
+            sweep->payload_free[cls] = NULL;
+        }
+    }
+
+    if (sweep->envs != NULL)
+    {
+        sweep->envs_tail->gc_next = gc_old_envs;
+        gc_old_envs = sweep->envs;
+        sweep->envs = NULL;
+    }
+
+    gc_num_objects -= sweep->objects_freed;
+    gc_payload_bytes -= sweep->payload_freed;
+    gc_old_bytes += sweep->old_bytes;
+    gc_stats.objects_freed += sweep->objects_freed;
+    gc_stats.objects_promoted += sweep->objects_promoted;
+    gc_stats.envs_freed += sweep->envs_freed;
+
+    sweep->payload_freed = 0;
+    sweep->old_bytes = 0;
+    sweep->objects_freed = 0;
+    sweep->objects_promoted = 0;
+    sweep->envs_freed = 0;
+}
+
+static void gc_clear_remembered(void)
+{
+    gc_remembered_count = 0;
+}
+
+static GC_InternEntry *gc_intern_table_alloc(int capacity)
+{
+    GC_InternEntry *table = calloc(capacity, sizeof(GC_InternEntry));
+    if (table == NULL)
+    {
+        fprintf(stderr, "GC: Failed to grow intern table\n");
+        exit(1);
+    }
+    return table;
+}
+
+static void gc_intern_place(GC_InternEntry entry)
+{
+    int mask = gc_interned_capacity - 1;
+    int i = entry.hash & mask;
+
+    while (gc_interned[i].string != NULL)
+    {
+        i = (i + 1) & mask;
+    }
+    gc_interned[i] = entry;
+    gc_interned_count++;
+}
+
+Object *gc_intern_find(const char *bytes, int length, uint32_t hash)
+{
+    if (gc_interned_count == 0)
+    {
+        return NULL;
+    }
+
+    int mask = gc_interned_capacity - 1;
+    for (int i = hash & mask; gc_interned[i].string != NULL; i = (i + 1) & mask)
+    {
+        Object *string = gc_interned[i].string;
+        if (gc_interned[i].hash == hash && string_object_length(string) == length &&
+            memcmp(string_object_bytes(string), bytes, length) == 0)
+        {
+            /* The entry does not keep the string alive, so the marker may
+             * not have seen it; handing it out makes it reachable again */
+            if (gc_phase == GC_MARKING)
+            {
+                gc_mark_object(string);
+            }
+            return string;
+        }
+    }
+    return NULL;
+}
+
+void gc_intern_add(Object *string, uint32_t hash)
+{
+    if ((gc_interned_count + 1) * 2 > gc_interned_capacity)
+    {
+        GC_InternEntry *old = gc_interned;
+        int old_capacity = gc_interned_capacity;
+
+        gc_interned_capacity = old_capacity < 64 ? 64 : old_capacity * 2;
+        gc_interned = gc_intern_table_alloc(gc_interned_capacity);
+        gc_interned_count = 0;
+        for (int i = 0; i < old_capacity; i++)
+        {
+            if (old[i].string != NULL)
+            {
+                gc_intern_place(old[i]);
+            }
+        }
+        free(old);
+    }
+
+    GC_InternEntry entry = {string, hash};
+    gc_intern_place(entry);
+
+    /* Old strings (including ones the pending sweep will make old) are only
+     * checked by the next full collection */
+    if (gc_block_of(string)->unswept || GC_TEST(string, old))
+    {
+        return;
+    }
+
+    if (gc_interned_young_count == gc_interned_young_capacity)
+    {
+        int new_capacity = gc_interned_young_capacity < 64 ? 64 : gc_interned_young_capacity * 2;
+        GC_InternEntry *new_young = realloc(gc_interned_young, sizeof(*new_young) * new_capacity);
+        if (new_young == NULL)
+        {
+            fprintf(stderr, "GC: Failed to grow intern table\n");
+            exit(1);
+        }
+        gc_interned_young = new_young;
+        gc_interned_young_capacity = new_capacity;
+    }
+    gc_interned_young[gc_interned_young_count++] = entry;
+}
+
+/* Remove one entry, shifting back the entries after it in its probe run so
+ * no lookup stops short at the hole */
+static void gc_intern_remove(Object *string, uint32_t hash)
+{
+    int mask = gc_interned_capacity - 1;
+    int hole = hash & mask;
+
+    while (gc_interned[hole].string != string)
+    {
+        hole = (hole + 1) & mask;
+    }
+
+    for (int i = (hole + 1) & mask; gc_interned[i].string != NULL; i = (i + 1) & mask)
+    {
+        int home = gc_interned[i].hash & mask;
+
+        /* Move the entry into the hole unless its home lies after the hole */
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            gc_interned[hole] = gc_interned[i];
+            hole = i;
+        }
+    }
+    gc_interned[hole].string = NULL;
+    gc_interned_count--;
+}
+
+/* After a minor collection's marking: drop the young entries not marked */
+static void gc_intern_sweep_young(void)
+{
+    for (int i = 0; i < gc_interned_young_count; i++)
+    {
+        if (!GC_TEST(gc_interned_young[i].string, marked))
+        {
+            gc_intern_remove(gc_interned_young[i].string, gc_interned_young[i].hash);
+        }
+    }
+    gc_interned_young_count = 0;
+}
+
+/* After a full cycle's marking: keep only the marked entries */
+static void gc_intern_sweep_all(void)
+{
+    GC_InternEntry *old = gc_interned;
+
+    if (gc_interned_count == 0)
+    {
+        gc_interned_young_count = 0;
+        return;
+    }
+
+    gc_interned = gc_intern_table_alloc(gc_interned_capacity);
+    gc_interned_count = 0;
+    for (int i = 0; i < gc_interned_capacity; i++)
+    {
+        if (old[i].string != NULL && GC_TEST(old[i].string, marked))
+        {
+            gc_intern_place(old[i]);
+        }
+    }
+    free(old);
+    gc_interned_young_count = 0;
+}
+
+static void gc_collect_minor(void)
+{
+    GC_Sweep sweep = {0};
+
+    gc_minor = 1;
+
+    /* Mark phase: roots plus remembered slots, skipping popped elements */
+    gc_mark_roots();
+    for (int i = 0; i < gc_remembered_count; i++)
+    {
+        Object *owner = gc_remembered[i].owner;
+        int slot = gc_remembered[i].slot;
+
+        if (owner->type == OBJECT_CELL)
+        {
+            gc_mark_object(owner->value.cell);
+        }
+        else if (owner->type == OBJECT_ARRAY && !(owner->flags & OBJECT_ARRAY_INTS) &&
+                 slot < owner->value.array->length)
+        {
+            gc_mark_object(owner->value.array->elements[slot]);
+        }
+        else if (owner->type == OBJECT_HASH && slot < owner->value.hash->capacity)
+        {
+            /* Entries move, so this may be another entry by now; the moved
+             * one was remembered again at its new slot */
+            HashEntry *entry = &owner->value.hash->entries[slot];
+            if (entry->value != NULL && entry->key_type == OBJECT_STRING)
+            {
+                gc_mark_object(entry->key.string);
+            }
+            gc_mark_object(entry->value);
+        }
+    }
+    gc_drain_all();
+    gc_intern_sweep_young();
+
+    gc_minor = 0;
+
+    /* Every young survivor is now old, so no old object points to a young one */
+    GC_Block *block = gc_young_blocks;
+    while (block != NULL)
+    {
+        GC_Block *next = block->next_young;
+        gc_sweep_block(&sweep, block, 1);
+        block->on_young_list = 0;
+        if (block != gc_alloc_block)
+        {
+            gc_release_block(block);
+        }
+        block = next;
+    }
+    gc_young_blocks = NULL;
+
+    sweep.epoch = gc_epoch;
+    Environment *env = gc_young_envs;
+    while (env != NULL)
+    {
+        Environment *next = env->gc_next;
+        gc_sweep_env(&sweep, env);
+        env = next;
+    }
+    gc_young_envs = NULL;
+    gc_young_bytes = 0;
+
+    gc_sweep_publish(&sweep);
+    gc_clear_remembered();
+
+    gc_epoch++;
+    gc_stats.collections_run++;
+    gc_stats.minor_collections++;
+}
+
+/* Begin a full cycle by shading the roots */
+static void gc_start_cycle(void)
+{
+    gc_phase = GC_MARKING;
+    gc_mark_roots();
+}
+
+/* Sweep up to `budget` object cells and environments. Returns 1 once
+ * nothing is left to sweep. Runs on the sweeper thread in background mode. */
+static int gc_sweep_some(GC_Sweep *sweep, int budget)
+{
+    while (sweep->pending != NULL && budget > 0)
+    {
+        GC_Block *block = sweep->pending;
+        sweep->pending = block->next;
+
+        gc_sweep_block(sweep, block, 0);
+        budget -= GC_BLOCK_CELLS;
+
+        /* Keep empty blocks for reuse; they are on no other list */
+        if (block->live == 0)
+        {
+            pthread_mutex_lock(&gc_heap_lock);
+            block->next = gc_spare_blocks;
+            gc_spare_blocks = block;
+            pthread_mutex_unlock(&gc_heap_lock);
+            continue;
+        }
+
+        /* Link the block before releasing it: once on the free list it
+         * belongs to the allocator */
+        block->next = NULL;
+        if (sweep->swept == NULL)
+        {
+            sweep->swept = block;
+        }
+        else
+        {
+            sweep->swept_tail->next = block;
+        }
+        sweep->swept_tail = block;
+        gc_release_block(block);
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        while (sweep->envs_pending[i] != NULL && budget-- > 0)
+        {
+            Environment *env = sweep->envs_pending[i];
+            sweep->envs_pending[i] = env->gc_next;
+            gc_sweep_env(sweep, env);
+        }
+    }
+
+    return sweep->pending == NULL && sweep->envs_pending[0] == NULL &&
+           sweep->envs_pending[1] == NULL;
+}
+
+static void *gc_sweeper_main(void *arg)
+{
+    (void)arg;
+    gc_sweep_some(&gc_sweep, INT_MAX);
+
+    pthread_mutex_lock(&gc_heap_lock);
+    gc_sweeper_done = 1;
+    pthread_mutex_unlock(&gc_heap_lock);
+    return NULL;
+}
+
+static int gc_sweeper_finished(void)
+{
+    pthread_mutex_lock(&gc_heap_lock);
+    int done = gc_sweeper_done;
+    pthread_mutex_unlock(&gc_heap_lock);
+    return done;
+}
+
+/* Marking is complete: hand both generations to the sweeper, on a thread of
+ * its own if `background` is set and one can be started. Everything marked
+ * survives and ends up old, so the remembered set is no longer needed. */
+static void gc_finish_marking(int background)
+{
+    gc_intern_sweep_all();
+
+    /* Every block is unswept now, so none may be allocated from until the
+     * sweeper has been through it. */
+    pthread_mutex_lock(&gc_heap_lock);
+    for (GC_Block *block = gc_free_blocks; block != NULL; block = block->next_free)
+    {
+        block->on_free_list = 0;
+    }
+    gc_free_blocks = NULL;
+    pthread_mutex_unlock(&gc_heap_lock);
+
+    for (GC_Block *block = gc_young_blocks; block != NULL; block = block->next_young)
+    {
+        block->on_young_list = 0;
+    }
+    gc_young_blocks = NULL;
+    gc_alloc_block = NULL;
+
+    /* Blocks created during the sweep start on a fresh heap list */
+    for (GC_Block *block = gc_blocks; block != NULL; block = block->next)
+    {
+        block->unswept = 1;
+    }
+    gc_sweep.pending = gc_blocks;
+    gc_sweep.swept = NULL;
+    gc_sweep.swept_tail = NULL;
+    gc_blocks = NULL;
+
+    gc_old_bytes = 0;
+    gc_young_bytes = 0;
+
+    gc_sweep.envs_pending[0] = gc_old_envs;
+    gc_sweep.envs_pending[1] = gc_young_envs;
+    gc_sweep.epoch = gc_epoch;
+    gc_old_envs = NULL;
+    gc_young_envs = NULL;
+
+    gc_clear_remembered();
+    gc_phase = GC_SWEEPING;
+
+    if (background)
+    {
+        gc_sweeper_done = 0;
+        /* Without a thread the sweep simply runs lazily */
+        gc_sweeper_running = pthread_create(&gc_sweeper, NULL, gc_sweeper_main, NULL) == 0;
+    }
+}
+
+/* Sweep up to `budget` object cells and environments, or with the sweeper
+ * thread running, take its results once it is done (waiting for it if
+ * `budget` is INT_MAX). Returns 1 once the cycle is over. */
+static int gc_sweep_step(int budget)
+{
+    int done;
+
+    if (gc_sweeper_running)
+    {
+        if (budget < INT_MAX && !gc_sweeper_finished())
+        {
+            return 0;
+        }
+        pthread_join(gc_sweeper, NULL);
+        gc_sweeper_running = 0;
+        done = 1;
+    }
+    else
+    {
+        done = gc_sweep_some(&gc_sweep, budget);
+    }
+
+    gc_sweep_publish(&gc_sweep);
+    if (!done)
+    {
+        return 0;
+    }
+
+    /* Swept blocks rejoin the heap and their bitmaps can be read again */
+    for (GC_Block *block = gc_sweep.swept; block != NULL; block = block->next)
+    {
+        block->unswept = 0;
+    }
+    if (gc_sweep.swept != NULL)
+    {
+        gc_sweep.swept_tail->next = gc_blocks;
+        gc_blocks = gc_sweep.swept;
+        gc_sweep.swept = NULL;
+        gc_sweep.swept_tail = NULL;
+    }
+
+    /* Start a fresh epoch so every environment reads as unmarked again */
+    gc_epoch++;
+
+    /* Survivors were counted back into the old generation as they were swept */
+    gc_live_bytes = gc_old_bytes + gc_payload_bytes;
+    gc_schedule_full();
+
+    gc_phase = GC_IDLE;
+    gc_stats.collections_run++;
+    return 1;
+}
+
+/* Blocks are allocated GC_REGION_BLOCKS at a time: aligning each block on
+ * its own would waste close to a block per allocation */
+static GC_Block *gc_new_block(void)
+{
+    pthread_mutex_lock(&gc_heap_lock);
+    if (gc_spare_blocks == NULL)
+    {
+        void *memory;
+        if (posix_memalign(&memory, GC_BLOCK_BYTES, (size_t)GC_BLOCK_BYTES * GC_REGION_BLOCKS) != 0)
+        {
+            fprintf(stderr, "GC: Failed to allocate heap block\n");
+            exit(1);
+        }
+
+        for (int i = GC_REGION_BLOCKS - 1; i >= 0; i--)
+        {
+            GC_Block *spare = (GC_Block *)((char *)memory + (size_t)i * GC_BLOCK_BYTES);
+            spare->next = gc_spare_blocks;
+            gc_spare_blocks = spare;
+        }
+    }
+
+    GC_Block *block = gc_spare_blocks;
+    gc_spare_blocks = block->next;
+    pthread_mutex_unlock(&gc_heap_lock);
+
+    memset(block, 0, sizeof(GC_Block));
+    block->next = gc_blocks;
+    gc_blocks = block;
+    return block;
+}
+
+/* Take the first free cell of the current block, moving on to a block with
+ * free cells or a fresh block when it is full. The cell comes back with its
+ * in-use bit set and its mark and old bits clear. */
+static Object *gc_alloc_cell(void)
+{
+    GC_Block *block = gc_alloc_block;
+
+    while (block == NULL || block->live == GC_BLOCK_CELLS)
+    {
+        pthread_mutex_lock(&gc_heap_lock);
+        block = gc_free_blocks;
+        if (block != NULL)
+        {
+            /* The sweeper is done with any block it has released */
+            gc_free_blocks = block->next_free;
+            block->on_free_list = 0;
+            block->unswept = 0;
+        }
+        pthread_mutex_unlock(&gc_heap_lock);
+
+        if (block == NULL)
+        {
+            block = gc_new_block();
+        }
+        gc_alloc_block = block;
+    }
+
+    /* live < GC_BLOCK_CELLS, so a clear bit exists at or after the cursor */
+    int w = block->alloc_cursor / 64;
+    uint64_t free_bits = ~block->in_use[w] & gc_word_mask(w) & (~(uint64_t)0 << (block->alloc_cursor % 64));
+    while (free_bits == 0)
+    {
+        w++;
+        free_bits = ~block->in_use[w] & gc_word_mask(w);
+    }
+
+    int index = w * 64 + gc_ctz64(free_bits);
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    block->in_use[w] |= bit;
+    if (gc_concurrent_marking)
+    {
+        GC_ATOMIC_AND(&block->marked[w], ~bit);
+    }
+    else
+    {
+        block->marked[w] &= ~bit;
+    }
+    block->old[w] &= ~bit;
+    block->alloc_cursor = index + 1;
+    block->live++;
+
+    if (!block->on_young_list)
+    {
+        block->on_young_list = 1;
+        block->next_young = gc_young_blocks;
+        gc_young_blocks = block;
+    }
+    return &block->cells[index];
+}
+
+/* Do whatever collection work is due before the next allocation */
+static void gc_maybe_collect(void)
+{
+    double start;
+    int start_marker = 0;
+
+    if (gc_phase == GC_IDLE)
+    {
+        if (gc_young_bytes < gc_config.nursery_bytes)
+        {
+            return;
+        }
+
+        start = gc_now_us();
+        gc_collect_minor();
+        if (gc_old_bytes + gc_payload_bytes >= gc_trigger_bytes)
+        {
+            gc_start_cycle();
+
+            if (gc_concurrent_thread)
+            {
+                start_marker = 1;
+            }
+            else if (gc_mark_nworkers > 1)
+            {
+                /* Parallel marking is stop-the-world: mark the cycle in one go */
+                gc_drain_all();
+                gc_finish_marking(gc_config.background_sweep);
+            }
+        }
+    }
+    else
+    {
+        if (gc_alloc_count < GC_STEP_ALLOCS)
+        {
+            return;
+        }
+
+        /* Checking on the GC threads costs the evaluator no pause */
+        if ((gc_sweeper_running && !gc_sweeper_finished()) ||
+            (gc_concurrent_marking && !gc_concurrent_step()))
+        {
+            gc_alloc_count = 0;
+            return;
+        }
+
+        start = gc_now_us();
+        if (gc_concurrent_marking)
+        {
+            /* Remark: trace whatever the GC thread has not yet seen */
+            gc_stop_concurrent_mark();
+            gc_drain_gray(INT_MAX);
+            gc_finish_marking(gc_config.background_sweep);
+        }
+        else if (gc_phase == GC_MARKING)
+        {
+            if (gc_drain_gray(GC_MARK_BUDGET))
+            {
+                gc_finish_marking(gc_config.background_sweep);
+            }
+        }
+        else
+        {
+            gc_sweep_step(GC_SWEEP_BUDGET);
+        }
+    }
+
+    gc_record_pause(start);
+    gc_alloc_count = 0;
+
+    /* Waking the GC thread ends the pause; on a busy machine the wakeup
+     * can be slow, and the evaluator is free to run meanwhile */
+    if (start_marker)
+    {
+        gc_start_concurrent_mark();
+    }
+}
+
+Object *gc_alloc_object(void)
+{
+    gc_maybe_collect();
+
+    Object *obj = gc_alloc_cell();
+    obj->flags = 0;
+
+    /* Allocate black while marking: the snapshot does not include it */
+    if (gc_concurrent_marking)
+    {
+        GC_ATOMIC_OR(&GC_BITMAP(obj, marked), GC_BIT(obj));
+    }
+    else if (gc_phase == GC_MARKING)
+    {
+        GC_SET(obj, marked);
+    }
+
+    gc_num_objects++;
+    gc_young_bytes += sizeof(Object);
+    gc_alloc_count++;
+    gc_stats.objects_allocated++;
+
+    return obj;
+}
+
+Environment *gc_alloc_env(void)
+{
+    /* Environments count towards the same allocation budget as objects */
+    gc_maybe_collect();
+
+    Environment *env = new_environment();
+    if (gc_phase == GC_MARKING)
+    {
+        env->mark_epoch = gc_epoch;
+    }
+    env->gc_next = gc_young_envs;
+    gc_young_envs = env;
+
+    gc_young_bytes += sizeof(Environment);
+    gc_alloc_count++;
+    gc_stats.envs_allocated++;
+
+    return env;
+}
+
+void gc_collect(void)
+{
+#ifdef GC_DEBUG
+    int before = gc_num_objects;
+#endif
+    double start = gc_now_us();
+
+    /* Finish a cycle that is already sweeping; its marks are from the past */
+    if (gc_phase == GC_SWEEPING)
+    {
+        gc_sweep_step(INT_MAX);
+    }
+
+    if (gc_phase == GC_IDLE)
+    {
+        gc_start_cycle();
+    }
+    if (gc_concurrent_marking)
+    {
+        gc_stop_concurrent_mark();
+    }
+
+    gc_drain_all();
+    gc_finish_marking(0);
+    gc_sweep_step(INT_MAX);
+
+    gc_record_pause(start);
+    gc_alloc_count = 0;
+
+#ifdef GC_DEBUG
+    printf("GC: Collected %d objects (%d remaining)\n",
+           before - gc_num_objects, gc_num_objects);
+#endif
+}
+
+GC_Stats gc_get_stats(void)
+{
+    GC_Stats stats = gc_stats;
+    int threshold = stats.pauses - stats.pauses / 100;
+    int seen = 0;
+
+    stats.live_bytes = gc_live_bytes;
+    stats.trigger_bytes = gc_trigger_bytes;
+    stats.heap_bytes = gc_young_bytes + gc_old_bytes + gc_payload_bytes;
+    stats.object_bytes = sizeof(Object);
+    stats.pause_max_ms = gc_pause_max_us / 1000.0;
+    stats.pause_total_ms = gc_pause_total_us / 1000.0;
+    stats.pause_p99_ms = 0;
+
+    for (int i = 0; i < GC_PAUSE_BUCKETS && stats.pauses > 0; i++)
+    {
+        seen += gc_pause_histogram[i];
+        if (seen >= threshold)
+        {
+            /* Report the bucket's upper edge, or the true max past the end */
+            stats.pause_p99_ms = i == GC_PAUSE_BUCKETS - 1 ? stats.pause_max_ms : (i + 1) / 1000.0;
+            break;
+        }
+    }
+
+    return stats;
 }
@@ -3,30 +3,103 @@
 
 #include "object.h"
 
-/* GC Configuration */
-#define GC_THRESHOLD 1000 /* Trigger GC after this many allocations */
+#include <stddef.h>
+
+/* GC Configuration (defaults; see GC_Config for the runtime tunables) */
+#define GC_NURSERY_BYTES (64 * 1024)    /* Young-generation size that triggers a minor GC */
+#define GC_GROWTH_FACTOR 2.0            /* Old-generation growth over live bytes before a full GC */
+#define GC_MIN_HEAP_BYTES (1024 * 1024) /* Old-generation size below which no full GC starts */
+#define GC_BLOCK_BYTES 4096             /* Heap block holding fixed-size object cells */
+#define GC_STEP_ALLOCS 100     /* Allocations between incremental steps of a full cycle */
+#define GC_MARK_BUDGET 1000    /* Gray objects scanned per marking step */
+#define GC_SWEEP_BUDGET 2000   /* Objects and environments swept per sweeping step */
 
 /* GC Statistics (for debugging/monitoring) */
 typedef struct
 {
     int objects_allocated;
     int objects_freed;
-    int collections_run;
+    int objects_promoted;
+    int envs_allocated;
+    int envs_freed;
+    int collections_run;   /* Minor and full collections */
+    int minor_collections;
+    int pauses;            /* Times the mutator stopped for GC work */
+    double pause_max_ms;
+    double pause_total_ms;
+    double pause_p99_ms;
+    size_t live_bytes;     /* Bytes that survived the last full cycle */
+    size_t trigger_bytes;  /* Old-generation size that starts the next full cycle */
+    size_t heap_bytes;     /* Object cells, environments and payloads in use now */
+    size_t object_bytes;   /* Size of one object cell */
 } GC_Stats;
 
+/* Collection scheduling tunables */
+typedef struct
+{
+    size_t nursery_bytes;
+    double growth_factor;
+    size_t min_heap_bytes;
+    size_t soft_limit_bytes; /* 0 for no limit */
+    int background_sweep;    /* Sweep full cycles on a separate thread */
+    int mark_threads;        /* Threads sharing stop-the-world marking; above 1,
+                              * full cycles mark in one parallel pause */
+    int concurrent_mark;     /* Mark full cycles on a GC thread of their own */
+} GC_Config;
+
+/* Fill a config with the compiled-in defaults */
+void gc_config_defaults(GC_Config *config);
+
+/* Set one tunable by name ("nursery", "growth", "min-heap", "soft-limit",
+ * "mark-threads", or "background-sweep" and "concurrent-mark", which take 0
+ * or 1). Sizes accept a k/m/g suffix. Returns 0 if the name or value is
+ * invalid. */
+int gc_config_set(GC_Config *config, const char *name, const char *value);
+
+/* Apply PASATHAI_GC_NURSERY, PASATHAI_GC_GROWTH, PASATHAI_GC_MIN_HEAP,
+ * PASATHAI_GC_SOFT_LIMIT, PASATHAI_GC_BACKGROUND_SWEEP,
+ * PASATHAI_GC_MARK_THREADS and PASATHAI_GC_CONCURRENT_MARK from the
+ * environment. Returns 0 on an invalid value. */
+int gc_config_from_env(GC_Config *config);
+
+/* Use a config for scheduling; call after gc_init() */
+void gc_configure(const GC_Config *config);
+
 /* Initialize garbage collector */
 void gc_init(void);
 
 /* Allocate a new object tracked by GC */
 Object *gc_alloc_object(void);
 
-/* Run garbage collection cycle */
+/* Size-classed allocation for object payloads (string bytes, array
+ * elements). The caller passes the same size back when freeing or resizing. */
+void *gc_alloc_payload(size_t size);
+void *gc_realloc_payload(void *payload, size_t old_size, size_t new_size);
+void gc_free_payload(void *payload, size_t size);
+
+/* Allocate a closure environment tracked by GC */
+Environment *gc_alloc_env(void);
+
+/* Run a full garbage collection cycle over both generations to completion */
 void gc_collect(void);
 
+/* Must be called whenever a reference slot is stored to or cleared:
+ * `old_value` is the reference being replaced and `new_value` the one being
+ * stored (either may be NULL). `owner` is the object holding the slot, or
+ * NULL for an environment binding; `slot` is the array index, or 0. */
+void gc_write_barrier(Object *owner, int slot, Object *old_value, Object *new_value);
+
+/* With concurrent marking, the GC thread reads arrays, cells and environments
+ * while the evaluator runs. Bracket every change to the references held by an
+ * existing one (not a freshly allocated one) with these, and allocate no
+ * objects in between. Both are no-ops unless the GC thread is marking. */
+void gc_lock_object(const void *ptr);
+void gc_unlock_object(const void *ptr);
+
 /* Mark an object as reachable */
 void gc_mark_object(Object *obj);
 
-/* Mark all objects in an environment as reachable */
+/* Mark an environment, its bindings and its outer chain as reachable */
 void gc_mark_env(Environment *env);
 
 /* Get GC statistics */
@@ -39,6 +112,28 @@ void gc_set_global_env(Environment *env);
 void gc_push_env(Environment *env);
 void gc_pop_env(void);
 
+/* Shadow stack for values held only in C locals, such as an operand while
+ * the other one is evaluated. Take a scope, push each temporary once it is
+ * known, and restore the scope on every way out:
+ *
+ *     int scope = gc_root_scope();
+ *     gc_push_root(left);
+ *     ...
+ *     gc_restore_roots(scope);
+ *
+ * gc_root_slots() gives the values pushed since `scope` as an array, valid
+ * until the next push. */
+int gc_root_scope(void);
+void gc_push_root(Object *obj);
+void gc_restore_roots(int scope);
+Object **gc_root_slots(int scope);
+
+/* Weak table of interned strings: it hands out the string equal to `bytes`,
+ * if one is interned and still alive, but keeps none of them alive. Every
+ * interned string must be added with its string_hash_bytes() hash. */
+Object *gc_intern_find(const char *bytes, int length, uint32_t hash);
+void gc_intern_add(Object *string, uint32_t hash);
+
 /* Register singleton objects that should never be collected */
 void gc_register_singleton(Object *obj);
 
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L /* strdup */
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -345,6 +347,10 @@ void next_token(Lexer *l, Token *tok)
         tok->type = TOKEN_SEMICOLON;
         tok->literal = ";";
         break;
+    case ':':
+        tok->type = TOKEN_COLON;
+        tok->literal = ":";
+        break;
     case ',':
         tok->type = TOKEN_COMMA;
         tok->literal = ",";
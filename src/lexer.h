@@ -31,6 +31,7 @@ typedef enum
     // Delimiters
     TOKEN_COMMA,
     TOKEN_SEMICOLON,
+    TOKEN_COLON,
 
     TOKEN_LPAREN,
     TOKEN_RPAREN,
@@ -5,6 +5,7 @@
 #include "parser.h"
 #include "evaluator.h"
 #include "gc.h"
+#include "numeric.h"
 
 void init_evaluator();
 
@@ -53,7 +54,7 @@ static void run_file(const char *filename)
     {
         if (program->statements[i] != NULL)
         {
-            eval((Node *)program->statements[i]);
+            eval_statement((Node *)program->statements[i]);
         }
     }
 
@@ -113,7 +114,7 @@ static void run_repl(void)
         {
             if (program->statements[i] != NULL)
             {
-                Object *result = eval((Node *)program->statements[i]);
+                Object *result = eval_statement((Node *)program->statements[i]);
 
                 /* Print non-null results in REPL mode */
                 if (result != NULL && result->type != OBJECT_NULL)
@@ -128,7 +129,7 @@ static void run_repl(void)
                     }
                     else if (result->type == OBJECT_STRING)
                     {
-                        printf("%s\n", result->value.string.data);
+                        printf("%.*s\n", string_object_length(result), string_object_bytes(result));
                     }
                     else if (result->type == OBJECT_ERROR)
                     {
@@ -142,12 +143,38 @@ static void run_repl(void)
     printf("\nGoodbye!\n");
 }
 
+static void print_gc_stats(void)
+{
+    GC_Stats stats = gc_get_stats();
+    fprintf(stderr, "GC: %d objects allocated, %d freed, %d promoted\n",
+            stats.objects_allocated, stats.objects_freed, stats.objects_promoted);
+    fprintf(stderr, "GC: %d collections (%d minor, %d full)\n", stats.collections_run,
+            stats.minor_collections, stats.collections_run - stats.minor_collections);
+    fprintf(stderr, "GC: %d environments allocated, %d freed\n",
+            stats.envs_allocated, stats.envs_freed);
+    fprintf(stderr, "GC: %d pauses, %.3f ms total, max %.3f ms, p99 %.3f ms\n",
+            stats.pauses, stats.pause_total_ms, stats.pause_max_ms, stats.pause_p99_ms);
+    fprintf(stderr, "GC: %zu bytes live after last full cycle, next at %zu\n",
+            stats.live_bytes, stats.trigger_bytes);
+    fprintf(stderr, "GC: %zu bytes in use, %zu-byte objects\n", stats.heap_bytes, stats.object_bytes);
+}
+
 static void print_usage(const char *program_name)
 {
     printf("Usage: %s [options] [file]\n\n", program_name);
     printf("Options:\n");
-    printf("  -h, --help     Show this help message\n");
-    printf("  -v, --version  Show version information\n\n");
+    printf("  -h, --help            Show this help message\n");
+    printf("  -v, --version         Show version information\n");
+    printf("  --gc-stats            Print garbage collector statistics on exit\n");
+    printf("  --gc-nursery=SIZE     Young generation size (default 64k)\n");
+    printf("  --gc-growth=FACTOR    Heap growth over live data before a full GC (default 2)\n");
+    printf("  --gc-min-heap=SIZE    Heap size below which no full GC runs (default 1m)\n");
+    printf("  --gc-soft-limit=SIZE  Collect harder as the heap nears SIZE\n");
+    printf("  --gc-background-sweep=1  Sweep full collections on a background thread\n");
+    printf("  --gc-mark-threads=N   Mark with N threads, stopping the world for full GCs\n");
+    printf("  --gc-concurrent-mark=1  Mark full collections on a GC thread\n");
+    printf("                        (also PASATHAI_GC_NURSERY, _GROWTH, _MIN_HEAP, _SOFT_LIMIT,\n");
+    printf("                        _BACKGROUND_SWEEP, _MARK_THREADS, _CONCURRENT_MARK)\n\n");
     printf("Examples:\n");
     printf("  %s                Run in interactive REPL mode\n", program_name);
     printf("  %s program.thai  Execute a Thai program file\n", program_name);
@@ -155,40 +182,93 @@ static void print_usage(const char *program_name)
 
 int main(int argc, char *argv[])
 {
-    gc_init();
-    init_evaluator();
+    const char *filename = NULL;
+    int show_gc_stats = 0;
+    GC_Config gc_config;
 
-    /* No arguments - run REPL */
-    if (argc == 1)
+    gc_config_defaults(&gc_config);
+    if (!gc_config_from_env(&gc_config))
     {
-        run_repl();
-        return 0;
+        return 1;
     }
 
-    /* Check for help flag */
-    if (argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))
+    for (int i = 1; i < argc; i++)
     {
-        print_usage(argv[0]);
-        return 0;
+        /* Check for help flag */
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+
+        /* Check for version flag */
+        if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--version") == 0)
+        {
+            printf("Pasathai v0.1.0\n");
+            printf("Thai Programming Language\n");
+            numeric_init();
+            printf("Numeric kernels: %s\n", numeric_isa());
+            return 0;
+        }
+
+        if (strcmp(argv[i], "--gc-stats") == 0)
+        {
+            show_gc_stats = 1;
+            continue;
+        }
+
+        /* GC tunables: --gc-<name>=<value> */
+        if (strncmp(argv[i], "--gc-", 5) == 0)
+        {
+            char name[32];
+            const char *eq = strchr(argv[i], '=');
+            size_t len = eq != NULL ? (size_t)(eq - argv[i] - 5) : 0;
+
+            if (eq == NULL || len >= sizeof(name))
+            {
+                printf("Error: Unknown option '%s'\n\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            memcpy(name, argv[i] + 5, len);
+            name[len] = '\0';
+            if (!gc_config_set(&gc_config, name, eq + 1))
+            {
+                printf("Error: Invalid option '%s'\n\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            continue;
+        }
+
+        /* Invalid usage */
+        if (filename != NULL)
+        {
+            printf("Error: Too many arguments\n\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        filename = argv[i];
     }
 
-    /* Check for version flag */
-    if (argc == 2 && (strcmp(argv[1], "-v") == 0 || strcmp(argv[1], "--version") == 0))
+    gc_init();
+    gc_configure(&gc_config);
+    init_evaluator();
+
+    if (filename == NULL)
     {
-        printf("Pasathai v0.1.0\n");
-        printf("Thai Programming Language\n");
-        return 0;
+        /* No file - run REPL */
+        run_repl();
     }
-
-    /* Run file */
-    if (argc == 2)
+    else
     {
-        run_file(argv[1]);
-        return 0;
+        run_file(filename);
     }
 
-    /* Invalid usage */
-    printf("Error: Too many arguments\n\n");
-    print_usage(argv[0]);
-    return 1;
+    if (show_gc_stats)
+    {
+        print_gc_stats();
+    }
+    return 0;
 }
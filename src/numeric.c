@@ -0,0 +1,337 @@
+#include "numeric.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NUMERIC_X86 1
+#include <immintrin.h>
+#endif
+
+/* Scalar kernels. Sums and products are taken on uint64_t, where overflow
+ * is defined to wrap; wrapping addition is associative, so the vector
+ * kernels may add in any order and still agree with these. */
+
+static int64_t sum_scalar(const int64_t *values, int count)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum += (uint64_t)values[i];
+    }
+    return (int64_t)sum;
+}
+
+static int64_t min_scalar(const int64_t *values, int count)
+{
+    int64_t min = values[0];
+    for (int i = 1; i < count; i++)
+    {
+        if (values[i] < min)
+        {
+            min = values[i];
+        }
+    }
+    return min;
+}
+
+static int64_t max_scalar(const int64_t *values, int count)
+{
+    int64_t max = values[0];
+    for (int i = 1; i < count; i++)
+    {
+        if (values[i] > max)
+        {
+            max = values[i];
+        }
+    }
+    return max;
+}
+
+static int64_t dot_scalar(const int64_t *a, const int64_t *b, int count)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum += (uint64_t)a[i] * (uint64_t)b[i];
+    }
+    return (int64_t)sum;
+}
+
+static void add_scalar(int64_t *out, const int64_t *a, const int64_t *b, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = (int64_t)((uint64_t)a[i] + (uint64_t)b[i]);
+    }
+}
+
+static void scale_scalar(int64_t *out, const int64_t *a, int64_t factor, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = (int64_t)((uint64_t)a[i] * (uint64_t)factor);
+    }
+}
+
+#ifdef NUMERIC_X86
+
+/* SSE2: two lanes. It has 64-bit addition but no 64-bit comparison, so
+ * min and max stay scalar at this level. */
+#define SSE2 __attribute__((target("sse2")))
+
+/* Low 64 bits of each product, built from 32-bit multiplies:
+ * lo(a)*lo(b) + ((lo(a)*hi(b) + hi(a)*lo(b)) << 32) */
+SSE2 static __m128i mul_sse2(__m128i a, __m128i b)
+{
+    __m128i low = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(a, _mm_srli_epi64(b, 32)),
+                                  _mm_mul_epu32(_mm_srli_epi64(a, 32), b));
+    return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+SSE2 static int64_t hsum_sse2(__m128i v)
+{
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1]);
+}
+
+SSE2 static int64_t sum_sse2(const int64_t *values, int count)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i *)(values + i)));
+    }
+    return (int64_t)((uint64_t)hsum_sse2(acc) + (uint64_t)sum_scalar(values + i, count - i));
+}
+
+SSE2 static int64_t dot_sse2(const int64_t *a, const int64_t *b, int count)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i product = mul_sse2(_mm_loadu_si128((const __m128i *)(a + i)),
+                                   _mm_loadu_si128((const __m128i *)(b + i)));
+        acc = _mm_add_epi64(acc, product);
+    }
+    return (int64_t)((uint64_t)hsum_sse2(acc) + (uint64_t)dot_scalar(a + i, b + i, count - i));
+}
+
+SSE2 static void add_sse2(int64_t *out, const int64_t *a, const int64_t *b, int count)
+{
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i *)(a + i)),
+                                    _mm_loadu_si128((const __m128i *)(b + i)));
+        _mm_storeu_si128((__m128i *)(out + i), sum);
+    }
+    add_scalar(out + i, a + i, b + i, count - i);
+}
+
+SSE2 static void scale_sse2(int64_t *out, const int64_t *a, int64_t factor, int count)
+{
+    __m128i f = _mm_set1_epi64x(factor);
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        _mm_storeu_si128((__m128i *)(out + i), mul_sse2(_mm_loadu_si128((const __m128i *)(a + i)), f));
+    }
+    scale_scalar(out + i, a + i, factor, count - i);
+}
+
+/* AVX2: four lanes, with a 64-bit signed comparison for min and max */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static __m256i mul_avx2(__m256i a, __m256i b)
+{
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)),
+                                     _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 static int64_t hsum_avx2(__m256i v)
+{
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return sum_scalar(lanes, 4);
+}
+
+AVX2 static int64_t sum_avx2(const int64_t *values, int count)
+{
+    /* Two accumulators, so consecutive additions do not wait on each other */
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256((const __m256i *)(values + i)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256((const __m256i *)(values + i + 4)));
+    }
+    int64_t sum = hsum_avx2(_mm256_add_epi64(acc0, acc1));
+    return (int64_t)((uint64_t)sum + (uint64_t)sum_scalar(values + i, count - i));
+}
+
+AVX2 static int64_t min_avx2(const int64_t *values, int count)
+{
+    if (count < 4)
+    {
+        return min_scalar(values, count);
+    }
+
+    __m256i best = _mm256_loadu_si256((const __m256i *)values);
+    int i = 4;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+        best = _mm256_blendv_epi8(best, v, _mm256_cmpgt_epi64(best, v));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, best);
+    int64_t min = min_scalar(lanes, 4);
+    if (i < count)
+    {
+        int64_t rest = min_scalar(values + i, count - i);
+        min = rest < min ? rest : min;
+    }
+    return min;
+}
+
+AVX2 static int64_t max_avx2(const int64_t *values, int count)
+{
+    if (count < 4)
+    {
+        return max_scalar(values, count);
+    }
+
+    __m256i best = _mm256_loadu_si256((const __m256i *)values);
+    int i = 4;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+        best = _mm256_blendv_epi8(best, v, _mm256_cmpgt_epi64(v, best));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, best);
+    int64_t max = max_scalar(lanes, 4);
+    if (i < count)
+    {
+        int64_t rest = max_scalar(values + i, count - i);
+        max = rest > max ? rest : max;
+    }
+    return max;
+}
+
+AVX2 static int64_t dot_avx2(const int64_t *a, const int64_t *b, int count)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i product = mul_avx2(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                   _mm256_loadu_si256((const __m256i *)(b + i)));
+        acc = _mm256_add_epi64(acc, product);
+    }
+    return (int64_t)((uint64_t)hsum_avx2(acc) + (uint64_t)dot_scalar(a + i, b + i, count - i));
+}
+
+AVX2 static void add_avx2(int64_t *out, const int64_t *a, const int64_t *b, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                       _mm256_loadu_si256((const __m256i *)(b + i)));
+        _mm256_storeu_si256((__m256i *)(out + i), sum);
+    }
+    add_scalar(out + i, a + i, b + i, count - i);
+}
+
+AVX2 static void scale_avx2(int64_t *out, const int64_t *a, int64_t factor, int count)
+{
+    __m256i f = _mm256_set1_epi64x(factor);
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm256_storeu_si256((__m256i *)(out + i), mul_avx2(_mm256_loadu_si256((const __m256i *)(a + i)), f));
+    }
+    scale_scalar(out + i, a + i, factor, count - i);
+}
+
+#endif /* NUMERIC_X86 */
+
+/* Kernels in use, chosen by numeric_init() */
+static struct
+{
+    const char *isa;
+    int64_t (*sum)(const int64_t *values, int count);
+    int64_t (*min)(const int64_t *values, int count);
+    int64_t (*max)(const int64_t *values, int count);
+    int64_t (*dot)(const int64_t *a, const int64_t *b, int count);
+    void (*add)(int64_t *out, const int64_t *a, const int64_t *b, int count);
+    void (*scale)(int64_t *out, const int64_t *a, int64_t factor, int count);
+} numeric_kernels = {"scalar", sum_scalar, min_scalar, max_scalar, dot_scalar, add_scalar, scale_scalar};
+
+void numeric_init(void)
+{
+#ifdef NUMERIC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        numeric_kernels.isa = "avx2";
+        numeric_kernels.sum = sum_avx2;
+        numeric_kernels.min = min_avx2;
+        numeric_kernels.max = max_avx2;
+        numeric_kernels.dot = dot_avx2;
+        numeric_kernels.add = add_avx2;
+        numeric_kernels.scale = scale_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        numeric_kernels.isa = "sse2";
+        numeric_kernels.sum = sum_sse2;
+        numeric_kernels.dot = dot_sse2;
+        numeric_kernels.add = add_sse2;
+        numeric_kernels.scale = scale_sse2;
+    }
+#endif
+}
+
+const char *numeric_isa(void)
+{
+    return numeric_kernels.isa;
+}
+
+int64_t numeric_sum(const int64_t *values, int count)
+{
+    return numeric_kernels.sum(values, count);
+}
+
+int64_t numeric_min(const int64_t *values, int count)
+{
+    return numeric_kernels.min(values, count);
+}
+
+int64_t numeric_max(const int64_t *values, int count)
+{
+    return numeric_kernels.max(values, count);
+}
+
+int64_t numeric_dot(const int64_t *a, const int64_t *b, int count)
+{
+    return numeric_kernels.dot(a, b, count);
+}
+
+void numeric_add(int64_t *out, const int64_t *a, const int64_t *b, int count)
+{
+    numeric_kernels.add(out, a, b, count);
+}
+
+void numeric_scale(int64_t *out, const int64_t *a, int64_t factor, int count)
+{
+    numeric_kernels.scale(out, a, factor, count);
+}
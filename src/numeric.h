@@ -0,0 +1,30 @@
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include <stdint.h>
+
+/* Kernels over int64 buffers for the numeric array built-ins. Each has a
+ * scalar version and, on x86, SSE2 and AVX2 ones picked by numeric_init()
+ * for the CPU it runs on. Arithmetic wraps on overflow, matching the
+ * interpreter's int64 arithmetic, so every version gives the same result. */
+
+/* Choose the kernels for this CPU; call once before any of the others */
+void numeric_init(void);
+
+/* Instruction set the kernels use: "avx2", "sse2" or "scalar" */
+const char *numeric_isa(void);
+
+int64_t numeric_sum(const int64_t *values, int count);
+
+/* Smallest and largest value; `count` must be at least 1 */
+int64_t numeric_min(const int64_t *values, int count);
+int64_t numeric_max(const int64_t *values, int count);
+
+/* Sum of the products of corresponding elements */
+int64_t numeric_dot(const int64_t *a, const int64_t *b, int count);
+
+/* out[i] = a[i] + b[i] and out[i] = a[i] * factor. `out` may be `a`. */
+void numeric_add(int64_t *out, const int64_t *a, const int64_t *b, int count);
+void numeric_scale(int64_t *out, const int64_t *a, int64_t factor, int count);
+
+#endif /* NUMERIC_H */
@@ -2,33 +2,85 @@
 #include <string.h>
 #include <stdio.h>
 #include "object.h"
+#include "gc.h"
 
 /* External error function from evaluator */
 extern void report_undefined_variable(const char *name, Environment *env);
 
+/* Released call frames, linked through `outer`. Their binding arrays are
+ * kept so a reused frame normally needs no allocation at all. */
+static Environment *frame_pool = NULL;
+
+static void *environment_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "Environment: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void environment_reserve(Environment *env, int capacity)
+{
+    if (capacity <= env->capacity)
+    {
+        return;
+    }
+
+    Environment_Binding *bindings = realloc(env->bindings, sizeof(*bindings) * capacity);
+    if (bindings == NULL)
+    {
+        fprintf(stderr, "Environment: out of memory\n");
+        exit(1);
+    }
+    env->bindings = bindings;
+    env->capacity = capacity;
+}
+
 Environment *new_environment()
 {
-    Environment *env = malloc(sizeof(Environment));
+    Environment *env = environment_alloc(sizeof(Environment));
     env->bindings = NULL;
+    env->count = 0;
+    env->capacity = 0;
     env->outer = NULL;
+    env->mark_epoch = 0;
+    env->gc_next = NULL;
     return env;
 }
 
-Object *environment_get(Environment *env, char *name)
+Environment_Binding *environment_find(Environment *env, char *name)
 {
-    Environment_Binding *binding = env->bindings;
-    while (binding != NULL)
+    for (int i = 0; i < env->count; i++)
     {
-        if (strcmp(binding->name, name) == 0)
+        if (strcmp(env->bindings[i].name, name) == 0)
         {
-            return binding->value;
+            return &env->bindings[i];
         }
-        binding = binding->next;
     }
+    return NULL;
+}
 
-    if (env->outer != NULL)
+Object *environment_get(Environment *env, char *name)
+{
+    while (env != NULL)
     {
-        return environment_get(env->outer, name);
+        Environment_Binding *binding = environment_find(env, name);
+        if (binding != NULL)
+        {
+            Object *value = binding->value;
+            if (value == NULL || value->type != OBJECT_CELL)
+            {
+                return value;
+            }
+            if (value->value.cell != NULL)
+            {
+                return value->value.cell;
+            }
+        }
+        env = env->outer;
     }
 
     return NULL;
@@ -36,9 +88,566 @@ Object *environment_get(Environment *env, char *name)
 
 void environment_set(Environment *env, char *name, Object *value)
 {
-    Environment_Binding *new_binding = malloc(sizeof(Environment_Binding));
-    new_binding->name = name;
-    new_binding->value = value;
-    new_binding->next = env->bindings;
-    env->bindings = new_binding;
+    /* Re-binding a name in the same scope replaces it; lookups only ever
+     * saw the newest binding anyway. */
+    Environment_Binding *binding = environment_find(env, name);
+    if (binding != NULL)
+    {
+        if (binding->value != NULL && binding->value->type == OBJECT_CELL)
+        {
+            Object *cell = binding->value;
+            gc_lock_object(cell);
+            gc_write_barrier(cell, 0, cell->value.cell, value);
+            cell->value.cell = value;
+            gc_unlock_object(cell);
+        }
+        else
+        {
+            gc_lock_object(env);
+            gc_write_barrier(NULL, 0, binding->value, value);
+            binding->value = value;
+            gc_unlock_object(env);
+        }
+        return;
+    }
+
+    gc_lock_object(env);
+    if (env->count == env->capacity)
+    {
+        environment_reserve(env, env->capacity < 4 ? 4 : env->capacity * 2);
+    }
+
+    env->bindings[env->count].name = name;
+    env->bindings[env->count].value = value;
+    env->count++;
+    gc_unlock_object(env);
+}
+
+Environment *new_frame(Environment *outer, int size)
+{
+    Environment *frame = frame_pool;
+    if (frame != NULL)
+    {
+        frame_pool = frame->outer;
+    }
+    else
+    {
+        frame = new_environment();
+    }
+
+    environment_reserve(frame, size);
+    frame->outer = outer;
+    return frame;
+}
+
+void release_frame(Environment *frame)
+{
+    frame->count = 0;
+    frame->outer = frame_pool;
+    frame_pool = frame;
+}
+
+void string_init(String *string, const char *bytes, int length)
+{
+    string->length = length;
+    string->chars = -1;
+    string->hash = 0;
+    string->crumbs = NULL;
+    memcpy(string->data, bytes, length);
+    string->data[length] = '\0';
+}
+
+int string_chars(String *string)
+{
+    if (string->chars < 0)
+    {
+        /* Every byte except a UTF-8 continuation byte starts a code point */
+        int chars = 0;
+        for (int i = 0; i < string->length; i++)
+        {
+            if (((unsigned char)string->data[i] & 0xC0) != 0x80)
+            {
+                chars++;
+            }
+        }
+        string->chars = chars;
+    }
+    return string->chars;
+}
+
+uint32_t string_hash_bytes(const char *bytes, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+uint32_t string_hash(String *string)
+{
+    if (string->hash == 0)
+    {
+        string->hash = string_hash_bytes(string->data, string->length);
+    }
+    return string->hash;
+}
+
+int string_equals(String *a, String *b)
+{
+    if (a == b)
+    {
+        return 1;
+    }
+    if (a->length != b->length)
+    {
+        return 0;
+    }
+    if (a->hash != 0 && b->hash != 0 && a->hash != b->hash)
+    {
+        return 0;
+    }
+    return memcmp(a->data, b->data, a->length) == 0;
+}
+
+int string_object_length(Object *string)
+{
+    if (string->flags & OBJECT_STRING_SMALL)
+    {
+        return string->small_length;
+    }
+    if (string->flags & OBJECT_STRING_VIEW)
+    {
+        return string->value.view->length;
+    }
+    if (string->flags & OBJECT_STRING_ROPE)
+    {
+        return string->value.rope->length;
+    }
+    return string->value.string->length;
+}
+
+int string_object_chars(Object *string)
+{
+    if (string->flags & OBJECT_STRING_SMALL)
+    {
+        const char *bytes = OBJECT_SMALL_BYTES(string);
+        int chars = 0;
+        for (int i = 0; i < string->small_length; i++)
+        {
+            if (((unsigned char)bytes[i] & 0xC0) != 0x80)
+            {
+                chars++;
+            }
+        }
+        return chars;
+    }
+    if (string->flags & OBJECT_STRING_VIEW)
+    {
+        return string->value.view->chars;
+    }
+    if (string->flags & OBJECT_STRING_ROPE)
+    {
+        return string->value.rope->chars;
+    }
+    return string_chars(string->value.string);
+}
+
+/* Advance `count` code points from byte `offset` */
+static int utf8_skip(const char *bytes, int length, int offset, int count)
+{
+    while (count > 0)
+    {
+        offset++;
+        while (offset < length && ((unsigned char)bytes[offset] & 0xC0) == 0x80)
+        {
+            offset++;
+        }
+        count--;
+    }
+    return offset;
+}
+
+static int string_offset(String *string, int index)
+{
+    /* Code points are bytes in an ASCII string */
+    if (string_chars(string) == string->length)
+    {
+        return index;
+    }
+    if (string->chars <= STRING_CRUMB_CHARS)
+    {
+        return utf8_skip(string->data, string->length, 0, index);
+    }
+
+    if (string->crumbs == NULL)
+    {
+        int *crumbs = gc_alloc_payload(STRING_CRUMBS_BYTES(string->chars));
+        int chars = 0;
+        for (int i = 0; i < string->length; i++)
+        {
+            if (((unsigned char)string->data[i] & 0xC0) != 0x80)
+            {
+                if (chars % STRING_CRUMB_CHARS == 0)
+                {
+                    crumbs[chars / STRING_CRUMB_CHARS] = i;
+                }
+                chars++;
+            }
+        }
+        string->crumbs = crumbs;
+    }
+
+    /* The index may be the code-point count itself, one past the last crumb */
+    int crumb = index / STRING_CRUMB_CHARS;
+    if (crumb * STRING_CRUMB_CHARS >= string->chars)
+    {
+        crumb--;
+    }
+    return utf8_skip(string->data, string->length, string->crumbs[crumb],
+                     index - crumb * STRING_CRUMB_CHARS);
+}
+
+int string_object_offset(Object *string, int index)
+{
+    if (string->flags & OBJECT_STRING_SMALL)
+    {
+        return utf8_skip(OBJECT_SMALL_BYTES(string), string->small_length, 0, index);
+    }
+    if (string->flags & OBJECT_STRING_VIEW)
+    {
+        StringView *view = string->value.view;
+        return string_offset(view->parent->value.string, view->first_char + index) - view->offset;
+    }
+    return string_offset(string_flatten(string), index);
+}
+
+String *string_flatten(Object *string)
+{
+    if (!(string->flags & OBJECT_STRING_ROPE))
+    {
+        return string->value.string;
+    }
+
+    Rope *rope = string->value.rope;
+    String *flat = gc_alloc_payload(STRING_BYTES(rope->length));
+    flat->length = rope->length;
+    flat->chars = rope->chars;
+    flat->hash = 0;
+    flat->crumbs = NULL;
+    flat->data[rope->length] = '\0';
+
+    /* Copy the pieces back to front. Right children are visited first, so
+     * the usual left-leaning rope keeps the pending stack at two entries. */
+    int capacity = 16;
+    int count = 0;
+    int end = rope->length;
+    Object **pending = malloc(sizeof(Object *) * capacity);
+    if (pending == NULL)
+    {
+        fprintf(stderr, "String: out of memory\n");
+        exit(1);
+    }
+    pending[count++] = rope->left;
+    pending[count++] = rope->right;
+
+    while (count > 0)
+    {
+        Object *piece = pending[--count];
+        if (piece->flags & OBJECT_STRING_ROPE)
+        {
+            if (count + 2 > capacity)
+            {
+                capacity *= 2;
+                Object **grown = realloc(pending, sizeof(Object *) * capacity);
+                if (grown == NULL)
+                {
+                    fprintf(stderr, "String: out of memory\n");
+                    exit(1);
+                }
+                pending = grown;
+            }
+            pending[count++] = piece->value.rope->left;
+            pending[count++] = piece->value.rope->right;
+        }
+        else
+        {
+            int length = string_object_length(piece);
+            end -= length;
+            memcpy(flat->data + end, string_object_bytes(piece), length);
+        }
+    }
+    free(pending);
+
+    /* The operands are dropped, which the marker has to hear about */
+    gc_lock_object(string);
+    gc_write_barrier(string, 0, rope->left, NULL);
+    gc_write_barrier(string, 1, rope->right, NULL);
+    string->value.string = flat;
+    string->flags = OBJECT_STRING_OWNED;
+    gc_unlock_object(string);
+
+    gc_free_payload(rope, sizeof(Rope));
+    return flat;
+}
+
+const char *string_object_bytes(Object *string)
+{
+    if (string->flags & OBJECT_STRING_SMALL)
+    {
+        return OBJECT_SMALL_BYTES(string);
+    }
+    if (string->flags & OBJECT_STRING_VIEW)
+    {
+        StringView *view = string->value.view;
+        return view->parent->value.string->data + view->offset;
+    }
+    return string_flatten(string)->data;
+}
+
+int string_object_equals(Object *a, Object *b)
+{
+    if (a == b)
+    {
+        return 1;
+    }
+    if (a->flags & b->flags & OBJECT_STRING_INTERNED)
+    {
+        return 0;
+    }
+
+    int length = string_object_length(a);
+    if (length != string_object_length(b))
+    {
+        return 0;
+    }
+    if (!((a->flags | b->flags) & (OBJECT_STRING_SMALL | OBJECT_STRING_VIEW)))
+    {
+        return string_equals(string_flatten(a), string_flatten(b));
+    }
+    return memcmp(string_object_bytes(a), string_object_bytes(b), length) == 0;
+}
+
+int hash_key_valid(Object *key)
+{
+    return key->type == OBJECT_STRING || key->type == OBJECT_INTEGER || key->type == OBJECT_BOOLEAN;
+}
+
+uint32_t hash_key_hash(Object *key)
+{
+    if (key->type == OBJECT_INTEGER)
+    {
+        /* Mix all 64 bits so that keys differing only high up spread out too */
+        uint64_t x = (uint64_t)key->value.integer;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return (uint32_t)x;
+    }
+    if (key->type == OBJECT_BOOLEAN)
+    {
+        return key->value.boolean ? 0x9e3779b9u : 0x7f4a7c15u;
+    }
+    if (key->flags & (OBJECT_STRING_SMALL | OBJECT_STRING_VIEW))
+    {
+        return string_hash_bytes(string_object_bytes(key), string_object_length(key));
+    }
+    return string_hash(string_flatten(key));
+}
+
+/* An entry for `key`; a string key is referenced, any other is copied */
+static HashEntry hash_entry_new(Object *key, Object *value, uint32_t hash)
+{
+    HashEntry entry;
+    if (key->type == OBJECT_STRING)
+    {
+        entry.key.string = key;
+    }
+    else
+    {
+        entry.key.scalar = key->type == OBJECT_INTEGER ? key->value.integer : (key->value.boolean != 0);
+    }
+    entry.value = value;
+    entry.hash = hash;
+    entry.key_type = key->type;
+    return entry;
+}
+
+static int hash_key_equals(HashEntry *entry, Object *key)
+{
+    if (entry->key_type != key->type)
+    {
+        return 0;
+    }
+    if (key->type == OBJECT_STRING)
+    {
+        return string_object_equals(entry->key.string, key);
+    }
+    if (key->type == OBJECT_INTEGER)
+    {
+        return entry->key.scalar == key->value.integer;
+    }
+    return entry->key.scalar == (key->value.boolean != 0);
+}
+
+/* The string an entry references, or NULL for an empty slot or a key kept
+ * by value */
+static Object *hash_entry_string(HashEntry *entry)
+{
+    return entry->value != NULL && entry->key_type == OBJECT_STRING ? entry->key.string : NULL;
+}
+
+HashTable *hash_table_new(int count)
+{
+    /* Grow before three quarters full, so probe sequences stay short */
+    int capacity = HASH_MIN_CAPACITY;
+    while (capacity / 4 * 3 < count)
+    {
+        capacity *= 2;
+    }
+
+    HashTable *table = gc_alloc_payload(HASH_TABLE_BYTES(capacity));
+    table->count = 0;
+    table->capacity = capacity;
+    memset(table->entries, 0, sizeof(HashEntry) * (size_t)capacity);
+    return table;
+}
+
+/* Slots between where a hash maps and where its entry sits */
+static int hash_distance(HashTable *table, int slot, uint32_t hash)
+{
+    return (slot - (int)(hash & (uint32_t)(table->capacity - 1))) & (table->capacity - 1);
+}
+
+static int hash_find(HashTable *table, Object *key, uint32_t hash)
+{
+    int mask = table->capacity - 1;
+    for (int i = hash & mask, distance = 0;; i = (i + 1) & mask, distance++)
+    {
+        HashEntry *entry = &table->entries[i];
+        if (entry->value == NULL || hash_distance(table, i, entry->hash) < distance)
+        {
+            return -1;
+        }
+        if (entry->hash == hash && hash_key_equals(entry, key))
+        {
+            return i;
+        }
+    }
+}
+
+/* Overwrite a slot. Every move goes through the write barrier, since the
+ * remembered set records slots and the entry may be young. */
+static void hash_store(Object *hash, int slot, HashEntry entry)
+{
+    HashEntry *old = &hash->value.hash->entries[slot];
+    gc_write_barrier(hash, slot, hash_entry_string(old), hash_entry_string(&entry));
+    gc_write_barrier(hash, slot, old->value, entry.value);
+    *old = entry;
+}
+
+/* Insert an entry whose key is known to be absent, displacing any entry
+ * that sits closer to its home slot than this one would */
+static void hash_insert(Object *hash, HashEntry entry)
+{
+    HashTable *table = hash->value.hash;
+    int mask = table->capacity - 1;
+    int distance = 0;
+
+    for (int i = entry.hash & mask;; i = (i + 1) & mask, distance++)
+    {
+        HashEntry *slot = &table->entries[i];
+        if (slot->value == NULL)
+        {
+            hash_store(hash, i, entry);
+            break;
+        }
+
+        int slot_distance = hash_distance(table, i, slot->hash);
+        if (slot_distance < distance)
+        {
+            HashEntry displaced = *slot;
+            hash_store(hash, i, entry);
+            entry = displaced;
+            distance = slot_distance;
+        }
+    }
+    table->count++;
+}
+
+Object *hash_get(Object *hash, Object *key)
+{
+    HashTable *table = hash->value.hash;
+    int slot = hash_find(table, key, hash_key_hash(key));
+    return slot < 0 ? NULL : table->entries[slot].value;
+}
+
+void hash_set(Object *hash, Object *key, Object *value)
+{
+    /* Hashing flattens a rope key, which must not happen under the lock */
+    uint32_t key_hash = hash_key_hash(key);
+
+    gc_lock_object(hash);
+    HashTable *table = hash->value.hash;
+
+    int slot = hash_find(table, key, key_hash);
+    if (slot >= 0)
+    {
+        gc_write_barrier(hash, slot, table->entries[slot].value, value);
+        table->entries[slot].value = value;
+        gc_unlock_object(hash);
+        return;
+    }
+
+    if (table->count + 1 > table->capacity / 4 * 3)
+    {
+        HashTable *old = table;
+        hash->value.hash = hash_table_new(old->capacity);
+        for (int i = 0; i < old->capacity; i++)
+        {
+            if (old->entries[i].value != NULL)
+            {
+                hash_insert(hash, old->entries[i]);
+            }
+        }
+        gc_free_payload(old, HASH_TABLE_BYTES(old->capacity));
+    }
+
+    hash_insert(hash, hash_entry_new(key, value, key_hash));
+    gc_unlock_object(hash);
+}
+
+Object *hash_delete(Object *hash, Object *key)
+{
+    uint32_t key_hash = hash_key_hash(key);
+
+    gc_lock_object(hash);
+    HashTable *table = hash->value.hash;
+
+    int slot = hash_find(table, key, key_hash);
+    if (slot < 0)
+    {
+        gc_unlock_object(hash);
+        return NULL;
+    }
+    Object *value = table->entries[slot].value;
+
+    /* Shift the entries after it back a slot until one is already home */
+    int mask = table->capacity - 1;
+    int next = (slot + 1) & mask;
+    while (table->entries[next].value != NULL &&
+           hash_distance(table, next, table->entries[next].hash) > 0)
+    {
+        hash_store(hash, slot, table->entries[next]);
+        slot = next;
+        next = (next + 1) & mask;
+    }
+
+    HashEntry empty = {{NULL}, NULL, 0, 0};
+    hash_store(hash, slot, empty);
+    table->count--;
+    gc_unlock_object(hash);
+    return value;
 }
@@ -1,11 +1,11 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* Forward declarations from ast.h */
-typedef struct Identifier Identifier;
-typedef struct BlockStatement BlockStatement;
+typedef struct FunctionLiteral FunctionLiteral;
 
 /* Forward declaration for Object */
 typedef struct Object Object;
@@ -15,67 +15,266 @@ typedef enum
     OBJECT_INTEGER,
     OBJECT_BOOLEAN,
     OBJECT_NULL,
-    OBJECT_RETURN_VALUE,
     OBJECT_FUNCTION,
     OBJECT_BUILTIN,
     OBJECT_STRING,
     OBJECT_ARRAY,
+    OBJECT_HASH,
     OBJECT_ERROR,
+    OBJECT_CELL, /* Internal: a boxed variable shared by a frame and its closures */
 } ObjectType;
 
 typedef struct Environment_Binding
 {
     char *name;
     Object *value;
-    struct Environment_Binding *next;
 } Environment_Binding;
 
 typedef struct Environment
 {
-    Environment_Binding *bindings;
+    Environment_Binding *bindings; /* Contiguous; `count` of `capacity` in use */
+    int count;
+    int capacity;
     struct Environment *outer;
+
+    /* Garbage collection fields (closure environments only; the root scope
+     * and call frames are owned by the evaluator and never swept) */
+    unsigned int mark_epoch;  /* Equal to the GC epoch once traced this cycle */
+    struct Environment *gc_next; /* Next environment in GC linked list */
 } Environment;
 
+/* A binding whose value is an OBJECT_CELL is boxed: reads and writes go
+ * through the cell, and an empty cell (NULL value) reads as unbound. */
 Environment *new_environment();
 Object *environment_get(Environment *env, char *name);
 void environment_set(Environment *env, char *name, Object *value);
 
+/* Find a binding in this scope only, without following `outer` */
+Environment_Binding *environment_find(Environment *env, char *name);
+
+/* Call frames come from a reusable pool instead of a fresh malloc per call.
+ * A frame starts with room for `size` bindings and must be handed back with
+ * release_frame() once the call is over. Closures never point at frames
+ * (they copy or share what they capture), so every frame can be reused. */
+Environment *new_frame(Environment *outer, int size);
+void release_frame(Environment *frame);
+
+/* Builtins receive their arguments in a caller-owned buffer that is only
+ * valid for the duration of the call. Arity and argument types are declared
+ * in the Builtin descriptor and checked by the caller before dispatch, so
+ * the function itself can assume well-formed arguments. */
 typedef Object *(*BuiltinFunction)(Object **args, int arg_count);
 
-struct Object
+#define BUILTIN_VARIADIC -1 /* Arity value accepting any number of arguments */
+#define BUILTIN_MAX_PARAMS 4
+
+/* Set of accepted argument types, one bit per ObjectType */
+#define TYPE_MASK(type) (1u << (type))
+#define TYPE_ANY (~0u)
+
+typedef struct Builtin
 {
-    ObjectType type;
+    const char *name;
+    BuiltinFunction fn;
+    int arity;                                    /* or BUILTIN_VARIADIC */
+    unsigned int param_types[BUILTIN_MAX_PARAMS]; /* TYPE_MASK bits per parameter */
+} Builtin;
+
+/* Payload of an OBJECT_STRING. Strings are immutable: the byte length is
+ * fixed at creation, `data` is NUL-terminated after it, and the code-point
+ * count and hash are filled in the first time they are asked for. */
+typedef struct String
+{
+    int length;    /* Bytes, excluding the NUL */
+    int chars;     /* UTF-8 code points, or -1 until counted */
+    uint32_t hash; /* 0 until computed */
+    int *crumbs;   /* Byte offset of every STRING_CRUMB_CHARS-th code point,
+                    * built on the first index into a long non-ASCII string */
+    char data[];
+} String;
+
+#define STRING_BYTES(length) (sizeof(String) + (size_t)(length) + 1)
+
+/* Indexing scans at most this many code points past a breadcrumb */
+#define STRING_CRUMB_CHARS 64
+#define STRING_CRUMBS_BYTES(chars) (sizeof(int) * (size_t)(((chars) + STRING_CRUMB_CHARS - 1) / STRING_CRUMB_CHARS))
+
+/* Fill a STRING_BYTES(length) buffer with a copy of `bytes` */
+void string_init(String *string, const char *bytes, int length);
+
+/* Code points in the string, counted once */
+int string_chars(String *string);
+
+/* FNV-1a hash of the bytes, computed once; never 0 */
+uint32_t string_hash(String *string);
+uint32_t string_hash_bytes(const char *bytes, int length);
 
-    /* Garbage collection fields */
-    int marked;      /* Mark bit for GC mark phase */
-    Object *gc_next; /* Next object in GC linked list */
+/* Byte-wise equality, rejecting on length and cached hashes first */
+int string_equals(String *a, String *b);
+
+/* Payload of an OBJECT_STRING flagged OBJECT_STRING_ROPE: a concatenation
+ * kept as its two operands until something needs its bytes, so building a
+ * string piece by piece copies it once instead of once per piece */
+typedef struct Rope
+{
+    int length;    /* Bytes */
+    int chars;     /* Code points */
+    Object *left;  /* OBJECT_STRINGs, flat or ropes themselves */
+    Object *right;
+} Rope;
+
+#define ROPE_MIN_LENGTH 128 /* Shorter concatenations are copied flat */
+
+/* Payload of an OBJECT_STRING flagged OBJECT_STRING_VIEW: a slice sharing
+ * the bytes of a flat parent string, which it keeps alive */
+typedef struct StringView
+{
+    Object *parent;  /* A flat OBJECT_STRING, never a view itself */
+    int offset;      /* Bytes into the parent */
+    int first_char;  /* Code points into the parent */
+    int length;      /* Bytes */
+    int chars;       /* Code points */
+} StringView;
+
+/* A slice is copied out instead of viewed when its parent is at least this
+ * many bytes and this many times the slice's length, so a few short slices
+ * do not pin a large text */
+#define STRING_VIEW_PIN_BYTES 4096
+#define STRING_VIEW_PIN_RATIO 16
+
+/* Byte length and code points of an OBJECT_STRING, without flattening it */
+int string_object_length(Object *string);
+int string_object_chars(Object *string);
+
+/* The String of a rope or flat OBJECT_STRING (not a small one or a view).
+ * A rope is copied out into a flat string the first time and stays flat. */
+String *string_flatten(Object *string);
+
+/* Byte offset of code point `index` (0 to the code-point count). ASCII
+ * strings index directly and long strings through breadcrumbs, so walking
+ * a string by index is linear overall. */
+int string_object_offset(Object *string, int index);
+
+/* The bytes of any OBJECT_STRING, string_object_length() of them. They are
+ * not NUL-terminated for a small string. */
+const char *string_object_bytes(Object *string);
+
+/* Equality of two OBJECT_STRINGs of any representation. Identical and
+ * distinct interned strings are told apart without reading their bytes. */
+int string_object_equals(Object *a, Object *b);
+
+/* Closure payload of an OBJECT_FUNCTION, kept out of line so the common
+ * small objects are not sized by it */
+typedef struct Closure
+{
+    FunctionLiteral *literal; /* Parameters and body, owned by the AST */
+    Environment *env;
+} Closure;
+
+/* Element buffer of an OBJECT_ARRAY. Growing it may move it, so reach it
+ * through the array object rather than keeping a pointer across a push.
+ * An array flagged OBJECT_ARRAY_INTS holds unboxed integers instead, read
+ * through ARRAY_INTS(); it references no objects. */
+typedef struct ArrayStorage
+{
+    int length;
+    int capacity;
+    Object *elements[];
+} ArrayStorage;
+
+#define ARRAY_STORAGE_BYTES(capacity) (sizeof(ArrayStorage) + sizeof(Object *) * (size_t)(capacity))
+#define ARRAY_INTS_BYTES(capacity) (sizeof(ArrayStorage) + sizeof(int64_t) * (size_t)(capacity))
+#define ARRAY_INTS(storage) ((int64_t *)(void *)(storage)->elements)
+
+/* Payload bytes of an OBJECT_ARRAY's storage in either representation */
+#define ARRAY_BYTES(obj) \
+    (((obj)->flags & OBJECT_ARRAY_INTS) ? ARRAY_INTS_BYTES((obj)->value.array->capacity) \
+                                        : ARRAY_STORAGE_BYTES((obj)->value.array->capacity))
+
+/* One slot of a HashTable; an empty slot has a NULL value. Integer and
+ * boolean keys are kept by value, so only string keys are references. */
+typedef struct HashEntry
+{
+    union
+    {
+        Object *string; /* An OBJECT_STRING, never a rope */
+        int64_t scalar; /* An integer, or a boolean as 0 or 1 */
+    } key;
+    Object *value;
+    uint32_t hash;    /* hash_key_hash() of the key */
+    uint8_t key_type; /* OBJECT_STRING, OBJECT_INTEGER or OBJECT_BOOLEAN */
+} HashEntry;
+
+/* Entry table of an OBJECT_HASH: open addressing with linear probing, kept
+ * in Robin Hood order so that a lookup stops as soon as it has probed
+ * further than the key could have been displaced. Entries move on insertion,
+ * deletion and growth, so like ArrayStorage it is reached through the hash
+ * object, and a slot index is only meaningful until the next change. */
+typedef struct HashTable
+{
+    int count;
+    int capacity; /* Power of two */
+    HashEntry entries[];
+} HashTable;
+
+#define HASH_TABLE_BYTES(capacity) (sizeof(HashTable) + sizeof(HashEntry) * (size_t)(capacity))
+#define HASH_MIN_CAPACITY 8
+
+/* Whether an object can be a hash key: a string, integer or boolean */
+int hash_key_valid(Object *key);
+
+/* Hash of a valid key. A rope key is flattened, and a flat string's hash is
+ * cached in its payload. */
+uint32_t hash_key_hash(Object *key);
+
+/* An empty table with room for `count` entries before it grows */
+HashTable *hash_table_new(int count);
+
+/* The value stored under `key` in an OBJECT_HASH, or NULL if there is none */
+Object *hash_get(Object *hash, Object *key);
+
+/* Store `value` under `key`, replacing any value already there */
+void hash_set(Object *hash, Object *key, Object *value);
+
+/* Remove `key`, returning the value it had or NULL if it was absent */
+Object *hash_delete(Object *hash, Object *key);
+
+/* Object flags */
+#define OBJECT_STRING_OWNED 1u /* String is a payload to free, not borrowed from the AST */
+#define OBJECT_STRING_ROPE 2u  /* Value is a Rope, not yet flattened */
+#define OBJECT_STRING_SMALL 4u /* Bytes are stored in the object itself; nothing to free */
+#define OBJECT_STRING_INTERNED 8u /* The only live interned string with these bytes */
+#define OBJECT_STRING_VIEW 16u    /* Value is a StringView into another string */
+#define OBJECT_ARRAY_INTS 32u     /* Every element is an integer, stored unboxed */
+
+/* 16 bytes: a small header and one pointer-sized value. Anything larger
+ * lives in a payload the value points at, except for short strings, whose
+ * bytes start at `small` and run on over `value`. */
+struct Object
+{
+    uint8_t type;         /* An ObjectType. GC state lives in the side bitmaps of the object's heap block */
+    uint8_t flags;        /* OBJECT_* flag bits of the payload */
+    uint8_t small_length; /* Bytes of an OBJECT_STRING_SMALL string */
+    char small[5];
 
     union
     {
         int64_t integer;
         int boolean;
-        struct
-        {
-            char *data;
-            int owned; /* 1 if string is malloc'd and should be freed, 0 if borrowed from AST */
-        } string;
+        String *string;
+        Rope *rope;
+        StringView *view;
         char *error;
-        Object *return_value;
-        struct
-        {
-            Identifier **parameters;
-            int parameter_count;
-            BlockStatement *body;
-            Environment *env;
-        } function;
-        struct
-        {
-            Object **elements;
-            int length;
-            int capacity;
-        } array;
-        BuiltinFunction builtin;
+        Closure *function;
+        ArrayStorage *array;
+        HashTable *hash;
+        const Builtin *builtin;
+        Object *cell; /* Current value of a boxed variable, NULL if unbound */
     } value;
 };
 
+/* Inline bytes of an OBJECT_STRING_SMALL string, not NUL-terminated */
+#define OBJECT_SMALL_MAX ((int)(sizeof(Object) - offsetof(Object, small)))
+#define OBJECT_SMALL_BYTES(obj) ((char *)(obj) + offsetof(Object, small))
+
 #endif /* OBJECT_H */
@@ -32,6 +32,7 @@ static Expression *parse_identifier(Parser *p);
 
 static Expression *parse_array_literal(Parser *p);
 static Expression *parse_index_expression(Parser *p, Expression *left);
+static Expression *parse_hash_literal(Parser *p);
 
 static void register_prefix(Parser *p, TokenType token_type, prefix_parse_fn fn)
 {
@@ -63,6 +64,7 @@ Parser *new_parser(Lexer *l)
     register_prefix(p, TOKEN_IF, parse_if_expression);
     register_prefix(p, TOKEN_FUNCTION, parse_function_literal);
     register_prefix(p, TOKEN_LBRACKET, parse_array_literal);
+    register_prefix(p, TOKEN_LBRACE, parse_hash_literal);
 
     memset(p->infix_parse_fns, 0, sizeof(p->infix_parse_fns));
     register_infix(p, TOKEN_PLUS, parse_infix_expression);
@@ -276,7 +278,7 @@ typedef enum
     PREC_CALL         // myFunction(X)
 } Precedence;
 
-static int precedences[] = {
+static int precedences[TOKEN_BEFORE_TO + 1] = {
     [TOKEN_EQ] = PREC_EQUALS,
     [TOKEN_NOT_EQ] = PREC_EQUALS,
     [TOKEN_LT] = PREC_LESSGREATER,
@@ -343,7 +345,10 @@ static Expression *parse_string_literal(Parser *p)
     StringLiteral *literal = malloc(sizeof(StringLiteral));
     literal->expression.node.type = NODE_STRING_LITERAL;
     literal->token = p->cur_token;
-    literal->value = p->cur_token.literal;
+
+    int length = strlen(p->cur_token.literal);
+    literal->value = malloc(STRING_BYTES(length));
+    string_init(literal->value, p->cur_token.literal, length);
     return (Expression *)literal;
 }
 
@@ -420,6 +425,7 @@ static Expression *parse_if_expression(Parser *p)
     IfExpression *exp = malloc(sizeof(IfExpression));
     exp->expression.node.type = NODE_IF_EXPRESSION;
     exp->token = p->cur_token;
+    exp->alternative = NULL;
 
     if (p->peek_token.type != TOKEN_LPAREN)
     {
@@ -501,6 +507,219 @@ static Identifier **parse_function_parameters(Parser *p, int *count)
     return params;
 }
 
+/* Scope analysis for function literals. Run once per literal after its body
+ * is parsed; nested literals are already analysed by then, so their free
+ * names can simply be folded into the enclosing function's sets. */
+typedef struct
+{
+    char **names;
+    int count;
+    int capacity;
+} NameSet;
+
+typedef struct
+{
+    NameSet references;  /* Names read in this body, including nested free names */
+    NameSet targets;     /* Names bound by ให้ or สำหรับ in this body itself */
+    NameSet nested_free; /* Names nested function literals capture */
+} ScopeInfo;
+
+static int name_set_contains(NameSet *set, const char *name)
+{
+    for (int i = 0; i < set->count; i++)
+    {
+        if (strcmp(set->names[i], name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void name_set_add(NameSet *set, char *name)
+{
+    if (name == NULL || name_set_contains(set, name))
+    {
+        return;
+    }
+
+    if (set->count == set->capacity)
+    {
+        set->capacity = set->capacity == 0 ? 8 : set->capacity * 2;
+        set->names = realloc(set->names, sizeof(*set->names) * set->capacity);
+    }
+    set->names[set->count++] = name;
+}
+
+static void analyze_node(Node *node, ScopeInfo *info);
+
+static void analyze_block(BlockStatement *block, ScopeInfo *info)
+{
+    if (block == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < block->statement_count; i++)
+    {
+        analyze_node((Node *)block->statements[i], info);
+    }
+}
+
+static void analyze_node(Node *node, ScopeInfo *info)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_IDENTIFIER:
+        name_set_add(&info->references, ((Identifier *)node)->value);
+        break;
+    case NODE_LET_STATEMENT:
+        analyze_node((Node *)((LetStatement *)node)->value, info);
+        name_set_add(&info->targets, ((LetStatement *)node)->name->value);
+        break;
+    case NODE_RETURN_STATEMENT:
+        analyze_node((Node *)((ReturnStatement *)node)->return_value, info);
+        break;
+    case NODE_EXPRESSION_STATEMENT:
+        analyze_node((Node *)((ExpressionStatement *)node)->expression, info);
+        break;
+    case NODE_BLOCK_STATEMENT:
+        analyze_block((BlockStatement *)node, info);
+        break;
+    case NODE_WHILE_STATEMENT:
+        analyze_node((Node *)((WhileStatement *)node)->condition, info);
+        analyze_block(((WhileStatement *)node)->body, info);
+        break;
+    case NODE_FOR_STATEMENT:
+    {
+        ForStatement *stmt = (ForStatement *)node;
+        analyze_node((Node *)stmt->start, info);
+        analyze_node((Node *)stmt->end, info);
+        name_set_add(&info->targets, stmt->variable->value);
+        analyze_block(stmt->body, info);
+        break;
+    }
+    case NODE_PREFIX_EXPRESSION:
+        analyze_node((Node *)((PrefixExpression *)node)->right, info);
+        break;
+    case NODE_INFIX_EXPRESSION:
+        analyze_node((Node *)((InfixExpression *)node)->left, info);
+        analyze_node((Node *)((InfixExpression *)node)->right, info);
+        break;
+    case NODE_IF_EXPRESSION:
+        analyze_node((Node *)((IfExpression *)node)->condition, info);
+        analyze_block(((IfExpression *)node)->consequence, info);
+        analyze_block(((IfExpression *)node)->alternative, info);
+        break;
+    case NODE_FUNCTION_LITERAL:
+    {
+        /* Already analysed: what it captures is read from this scope */
+        FunctionLiteral *lit = (FunctionLiteral *)node;
+        for (int i = 0; i < lit->free_count; i++)
+        {
+            name_set_add(&info->references, lit->free_names[i]);
+            name_set_add(&info->nested_free, lit->free_names[i]);
+        }
+        break;
+    }
+    case NODE_CALL_EXPRESSION:
+    {
+        CallExpression *call = (CallExpression *)node;
+        analyze_node((Node *)call->function, info);
+        for (int i = 0; i < call->argument_count; i++)
+        {
+            analyze_node((Node *)call->arguments[i], info);
+        }
+        break;
+    }
+    case NODE_ARRAY_LITERAL:
+    {
+        ArrayLiteral *arr = (ArrayLiteral *)node;
+        for (int i = 0; i < arr->element_count; i++)
+        {
+            analyze_node((Node *)arr->elements[i], info);
+        }
+        break;
+    }
+    case NODE_INDEX_EXPRESSION:
+        analyze_node((Node *)((IndexExpression *)node)->left, info);
+        analyze_node((Node *)((IndexExpression *)node)->index, info);
+        break;
+    case NODE_HASH_LITERAL:
+    {
+        HashLiteral *hash = (HashLiteral *)node;
+        for (int i = 0; i < hash->pair_count; i++)
+        {
+            analyze_node((Node *)hash->keys[i], info);
+            analyze_node((Node *)hash->values[i], info);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Fill in free_names, boxed_names and frame_size for a parsed literal */
+static void analyze_function_literal(FunctionLiteral *lit)
+{
+    ScopeInfo info = {{NULL, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}};
+    analyze_block(lit->body, &info);
+
+    NameSet parameters = {NULL, 0, 0};
+    for (int i = 0; i < lit->parameter_count; i++)
+    {
+        name_set_add(&parameters, lit->parameters[i]->value);
+    }
+
+    /* Free: everything read that is not a parameter. Locals stay in the set
+     * because a read may happen before the local is first bound. */
+    NameSet free_names = {NULL, 0, 0};
+    for (int i = 0; i < info.references.count; i++)
+    {
+        if (!name_set_contains(&parameters, info.references.names[i]))
+        {
+            name_set_add(&free_names, info.references.names[i]);
+        }
+    }
+
+    /* Boxed: own bindings that a nested closure captures and that this body
+     * (re)binds, so the closure must share the variable rather than a copy. */
+    NameSet boxed_names = {NULL, 0, 0};
+    for (int i = 0; i < info.targets.count; i++)
+    {
+        if (name_set_contains(&info.nested_free, info.targets.names[i]))
+        {
+            name_set_add(&boxed_names, info.targets.names[i]);
+        }
+    }
+
+    int frame_size = lit->parameter_count;
+    for (int i = 0; i < info.targets.count; i++)
+    {
+        if (!name_set_contains(&parameters, info.targets.names[i]))
+        {
+            frame_size++;
+        }
+    }
+
+    lit->free_names = free_names.names;
+    lit->free_count = free_names.count;
+    lit->boxed_names = boxed_names.names;
+    lit->boxed_count = boxed_names.count;
+    lit->frame_size = frame_size;
+
+    free(info.references.names);
+    free(info.targets.names);
+    free(info.nested_free.names);
+    free(parameters.names);
+}
+
 static Expression *parse_function_literal(Parser *p)
 {
     FunctionLiteral *lit = malloc(sizeof(FunctionLiteral));
@@ -514,6 +733,10 @@ static Expression *parse_function_literal(Parser *p)
     parser_next_token(p);
 
     lit->parameters = parse_function_parameters(p, &lit->parameter_count);
+    if (lit->parameters == NULL)
+    {
+        return NULL; // Error
+    }
 
     if (p->peek_token.type != TOKEN_LBRACE)
     {
@@ -522,6 +745,7 @@ static Expression *parse_function_literal(Parser *p)
     parser_next_token(p);
 
     lit->body = parse_block_statement(p);
+    analyze_function_literal(lit);
 
     return (Expression *)lit;
 }
@@ -774,3 +998,56 @@ static Expression *parse_index_expression(Parser *p, Expression *left)
 
     return (Expression *)exp;
 }
+
+static Expression *parse_hash_literal(Parser *p)
+{
+    HashLiteral *hash = malloc(sizeof(HashLiteral));
+    hash->expression.node.type = NODE_HASH_LITERAL;
+    hash->token = p->cur_token; /* The '{' token */
+    hash->keys = NULL;
+    hash->values = NULL;
+    hash->pair_count = 0;
+
+    int capacity = 0;
+    while (p->peek_token.type != TOKEN_RBRACE)
+    {
+        if (hash->pair_count == capacity)
+        {
+            capacity = capacity == 0 ? 8 : capacity * 2;
+            hash->keys = realloc(hash->keys, sizeof(Expression *) * capacity);
+            hash->values = realloc(hash->values, sizeof(Expression *) * capacity);
+        }
+
+        /* Parse key: value */
+        parser_next_token(p);
+        Expression *key = parse_expression(p, PREC_LOWEST);
+        if (p->peek_token.type != TOKEN_COLON)
+        {
+            parser_next_token(p); /* Move to peek to set as cur_token */
+            parser_error_expected(p, "':'");
+            return NULL;
+        }
+        parser_next_token(p); /* Consume colon */
+        parser_next_token(p); /* Move to value */
+        Expression *value = parse_expression(p, PREC_LOWEST);
+
+        hash->keys[hash->pair_count] = key;
+        hash->values[hash->pair_count] = value;
+        hash->pair_count++;
+
+        /* Pairs are separated by commas */
+        if (p->peek_token.type != TOKEN_RBRACE && p->peek_token.type != TOKEN_COMMA)
+        {
+            parser_next_token(p); /* Move to peek to set as cur_token */
+            parser_error_expected(p, "',' or '}'");
+            return NULL;
+        }
+        if (p->peek_token.type == TOKEN_COMMA)
+        {
+            parser_next_token(p);
+        }
+    }
+    parser_next_token(p); /* Consume closing brace */
+
+    return (Expression *)hash;
+}